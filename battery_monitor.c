@@ -6,11 +6,86 @@
 #include <unistd.h>
 #include <signal.h>
 #include <time.h>
+#include <stdarg.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <malloc.h>
 #include <errno.h>
+#include <dirent.h>
+#include <sys/socket.h>
+#include <sys/inotify.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <syslog.h>
+#include <linux/netlink.h>
 #include <gtk/gtk.h>
-#include <libnotify/notify.h>
+#include <glib-unix.h>
+#include <gio/gunixfdlist.h>
+
+// Seconds the user gets to plug in a charger before a critical suspend
+#define CRITICAL_GRACE_SECONDS 10
+
+// Hibernate escalation: assumed drain while suspended until one sleep has been measured
+// (percent per second, 1%/h), bounds for the RTC wake, and the alarm it is set through
+#define SLEEP_DRAIN_DEFAULT (1.0 / 3600.0)
+#define HIBERNATE_WAKE_MIN (10 * 60)
+#define HIBERNATE_WAKE_MAX (12 * 3600)
+#define RTC_WAKEALARM "/sys/class/rtc/rtc0/wakealarm"
+
+// Logging: per-key rate limit, file buffer size and the journal's native socket
+#define LOG_RATE_SLOTS 32
+#define LOG_RATE_BURST 5
+#define LOG_RATE_WINDOW (60 * G_USEC_PER_SEC)
+#define LOG_FILE_BUFFER 16384
+#define LOG_JOURNAL_SOCKET "/run/systemd/journal/socket"
+
+// Longest we wait for pre_suspend_hook, matching logind's default InhibitDelayMaxSec
+#define PRE_SUSPEND_HOOK_TIMEOUT 5
+
+// Bounds for the adaptive check interval, in seconds
+#define ADAPTIVE_MIN_INTERVAL 5
+#define ADAPTIVE_MAX_INTERVAL 900
+
+// Time constant of the power draw moving average, in seconds
+#define POWER_SMOOTHING_SECONDS 120.0
+
+// Discharge model file layout, one bin per percent
+#define MODEL_MAGIC 0x4d424c43     // "CLBM"
+#define MODEL_VERSION 1
+#define MODEL_BINS 101
+#define MODEL_MAX_WEIGHT 8         // Cycles a bin averages over, so it follows the pack's wear
+#define MODEL_GAP_SECONDS (20 * 60)
+
+// Resolved tray pixbufs kept around: battery, charging, low and missing
+#define TRAY_ICON_CACHE_SIZE 4
+
+// Battery history file layout
+#define HISTORY_MAGIC 0x48424c43   // "CLBH"
+#define HISTORY_VERSION 1
+#define HISTORY_CAPACITY 16384     // Records, about a week at the default check rate
+
+// Shared status segment layout
+#define STATUS_SEGMENT_MAGIC 0x53424c43   // "CLBS"
+#define STATUS_SEGMENT_VERSION 1
+
+// Status window graph: time shown across its width, and the gap that breaks the line
+#define GRAPH_SPAN_SECONDS (12 * 3600)
+#define GRAPH_GAP_SECONDS (20 * 60)
+
+// Upper bounds for the cached power supply set
+#define MAX_BATTERIES 8
+#define MAX_MAINS 4
+
+// Process attribution: open-addressed PID table (power of two) and how many to report
+#define PROCESS_TABLE_SIZE 4096
+#define TOP_PROCESS_COUNT 5
+
+// Start threshold while charging to full, just under the end so charging resumes right away
+#define CHARGE_FULL_START 95
+
 // Configuration structure
 typedef struct {
     int warning_level;          // Warning percentage (default 20%)
@@ -24,18 +99,114 @@ typedef struct {
     int force_suspend;          // Force suspend at critical level (1 = yes, 0 = no)
     int impossible_alerts;      // Show impossible to dismiss alerts (1 = yes, 0 = no)
     int suspend_method;         // Suspend method (0=systemctl, 1=pm-suspend, 2=dbus, 3=kernel)
+    int event_driven;           // React to kernel power_supply uevents (1 = yes, 0 = poll only)
+    int fallback_interval;      // Safety-net poll interval in seconds while event-driven (default 120)
+    char pre_suspend_hook[256]; // Command run before a critical suspend (empty = none)
+    int adaptive_interval;      // Schedule checks from the discharge rate (1 = yes, 0 = fixed interval)
+    int warning_minutes;        // Also warn when this many minutes remain (0 = percentage only)
+    int critical_minutes;       // Also treat as critical when this many minutes remain (0 = percentage only)
+    int critical_seconds;       // Also treat as critical when the discharge model predicts this little left (0 = off)
+    int hysteresis_percent;     // Recovery needed past a threshold before leaving its state
+    int alert_debounce;         // Seconds a battery state must hold before it is acted on
+    int charger_debounce;       // Same, for plugging in or pulling the charger
+    int warning_repeat;         // Seconds between repeated low battery alerts
+    int critical_repeat;        // Seconds between repeated critical alerts and suspend attempts
+    int hibernate_level;        // Hibernate instead when a critical suspend wakes below this (0 = never)
+    int hibernate_method;       // 0=hibernate, 1=suspend-then-hibernate, 2=hybrid-sleep
+    int charge_limit;           // Hold the battery between the start/end thresholds (1 = yes, 0 = no)
+    int charge_start_threshold; // Percent below which charging resumes while limited
+    int charge_end_threshold;   // Percent charging stops at while limited
+    char charge_full_schedule[256]; // "HH:MM-HH:MM,..." windows allowed to charge to 100%
+    int process_attribution;    // Rank CPU/power hogs while the battery is low (1 = yes, 0 = no)
+    char telemetry_url[512];    // http(s) endpoint for batched history uploads (empty = disabled)
+    int telemetry_interval;     // Minutes between uploads, charger connect also triggers one
+    int log_level;              // Most verbose syslog priority logged (3=errors ... 7=debug)
+    char log_file[512];         // Buffered log file (empty = journal under systemd, else stdout)
+    char action_power_profile[32];  // power-profiles-daemon profile while low (empty = leave alone)
+    int action_backlight;       // Dim the backlight to this percent while low (0 = leave alone)
+    char action_pause_units[512];   // systemd user units frozen while low, comma separated
+    char action_epp[32];        // CPU energy_performance_preference while low (empty = leave alone)
 } BatteryConfig;
 
+// Parts of the running monitor a config field feeds into
+#define CONFIG_EFFECT_CHANGED 0x01   // Something differs at all
+#define CONFIG_EFFECT_TIMER   0x02   // Check scheduling
+#define CONFIG_EFFECT_EVENTS  0x04   // Uevent subscription
+#define CONFIG_EFFECT_ICONS   0x08   // Tray icon names
+#define CONFIG_EFFECT_RECHECK 0x10   // Thresholds, so the battery is re-evaluated now
+#define CONFIG_EFFECT_CHARGE  0x20   // Charge-limit band or schedule
+#define CONFIG_EFFECT_LOG     0x40   // Log sink or level
+
+typedef enum {
+    CONFIG_INT,
+    CONFIG_STRING
+} ConfigKeyType;
+
+typedef struct {
+    const char *name;
+    ConfigKeyType type;
+    size_t offset;              // Into BatteryConfig
+    size_t size;
+    int effects;                // CONFIG_EFFECT_* flags
+    int min, max;               // Accepted range of an int key
+    const char *comment;        // Written above the key, NULL to group with the previous one
+} ConfigKey;
+
 // Global variables
 static BatteryConfig config;
+static GMainLoop *main_loop = NULL;
+static int quit_requested = 0;     // Quitting, once the power saving undo has landed
+static guint quit_deadline_id = 0;
+static int headless_mode = 0;          // --headless: GTK never initialized, no tray or dialogs, alerts go to the journal
+static gint64 startup_begin_time = 0;  // Monotonic time main() started
+static int startup_timing = 0;         // --startup-time: report time to first icon shown
 static GtkStatusIcon *tray_icon;
 static GtkWidget *menu;
 static guint timer_id;
 static int last_percentage = -1;
 static int last_charging_state = -1;
-static time_t last_alert_time = 0;
+
+// Confirmed alert state and the candidate waiting out its debounce window
+typedef enum {
+    ALERT_UNKNOWN,
+    ALERT_NORMAL,
+    ALERT_LOW,
+    ALERT_CRITICAL,
+    ALERT_CHARGING
+} AlertState;
+
+static AlertState alert_state = ALERT_UNKNOWN;
+static AlertState alert_pending = ALERT_UNKNOWN;
+static gint64 alert_pending_since = 0;  // monitor_clock() the candidate first showed, 0 if none
+static gint64 alert_last_time = 0;      // monitor_clock() of the last alert in this state, 0 if none yet
 static int alert_active = 0;
 static GtkWidget *alert_dialog = NULL;
+static int uevent_fd = -1;
+static guint uevent_source_id = 0;
+static guint uevent_idle_id = 0;
+static int charge_limit_managed = 0;      // We've written thresholds and owe a restore if disabled
+static int charge_travel_override = 0;    // "Full charge for travel" requested from the menu
+static int charge_travel_reached = 0;     // The travel charge got to full
+static gint64 charge_travel_started = 0;
+static GtkWidget *travel_item = NULL;
+static int telemetry_in_flight = 0;
+static gint64 telemetry_last_attempt = 0;  // Monotonic; startup counts, so the first upload waits an interval
+static int config_dirty = 0;              // Settings differ from what's on disk
+static int config_watch_fd = -1;          // inotify on the config directory
+static guint config_watch_source_id = 0;
+static guint critical_grace_id = 0;   // Pending suspend countdown, 0 when idle
+static gint64 critical_grace_started = 0;
+static GDBusProxy *logind_proxy = NULL;  // org.freedesktop.login1.Manager, connected at startup
+static int sleep_inhibit_fd = -1;        // logind delay lock held during the critical sequence
+static int sleep_inhibit_pending = 0;    // Inhibit() call in flight
+static int sleep_inhibit_wanted = 0;     // Cleared if the sequence ends before logind answers
+static GPid pre_suspend_hook_pid = 0;
+static guint pre_suspend_hook_timeout_id = 0;
+static int critical_sequence_suspend = 0;  // Whether the sequence ends in our own suspend
+static gint64 hibernate_wake_at = 0;       // Wall clock (s) our RTC alarm is due, 0 if none is set
+static gint64 sleep_started = 0;           // Wall clock (s) of the last PrepareForSleep
+static int sleep_started_percentage = -1;
+static double sleep_drain_rate = SLEEP_DRAIN_DEFAULT;  // Percent per second while suspended
 
 // Battery status structure
 typedef struct {
@@ -43,18 +214,462 @@ typedef struct {
     int charging;
     int present;
     char status[32];
-    int time_remaining;
+    int time_remaining;         // Minutes until empty (or full while charging), 0 if unknown
+    int battery_count;          // Batteries combined into this status
+    int ac_online;              // Any AC adapter reports online
+    long long energy_now;       // Combined energy (uWh, or uAh via charge_*), 0 if unknown
+    long long energy_full;
+    long long power_now;        // Combined draw (uW, or uA via current_now), 0 if unknown
+    int shutdown_seconds;       // Predicted by the discharge model while discharging, 0 if unknown
 } BatteryStatus;
 
+// Most recent sample, used to plan the next check
+static BatteryStatus last_status = {0};
+
+// Discharge rate estimate for the adaptive scheduler
+static double discharge_rate = 0.0;     // Percent per second, 0 when unknown
+static gint64 rate_sample_time = 0;     // Monotonic time (us) the current percentage was first seen
+static int rate_sample_percentage = -1;
+
+// Exponentially weighted power draw, so one noisy sample doesn't swing the estimate
+static double smoothed_power = 0.0;     // Same units as BatteryStatus.power_now
+static gint64 smoothed_power_time = 0;
+static int smoothed_power_charging = -1;
+
+// Learned discharge curve, stored next to the config
+typedef struct {
+    guint32 magic;
+    guint32 version;
+    guint32 cycles;             // Discharge cycles folded in so far
+    guint32 reserved;
+    float energy[MODEL_BINS];   // Mean energy drawn while at each percent, energy_now units
+    guint8 weight[MODEL_BINS];  // Cycles behind each bin, 0 = not learned yet
+} DischargeModel;
+
+static DischargeModel discharge_model = { MODEL_MAGIC, MODEL_VERSION };
+static double model_cycle_energy[MODEL_BINS];  // The cycle in progress, folded in when it ends
+static int model_cycle_high = -1;              // Percent the cycle started at, -1 outside one
+static int model_cycle_low = -1;
+static int model_last_capacity = 0;
+static gint64 model_last_time = 0;
+static double model_last_power = 0;
+static int model_bootstrapping = 0;            // Learning from the history file, don't save per cycle
+
+// Open sysfs attributes of one battery, kept across checks and re-read with pread()
+typedef struct {
+    char path[256];
+    int present_fd;
+    int capacity_fd;
+    int status_fd;
+    int energy_now_fd;          // uWh, or charge_now (uAh) on batteries without energy_*
+    int energy_full_fd;
+    int power_now_fd;           // uW, or current_now (uA) alongside charge_*
+    int reports_charge;         // energy_*/power_now fds actually point at charge_*/current_now
+    int charge_start;           // Last known charge_control_start_threshold, -1 if unsupported
+    int charge_end;             // Last known charge_control_end_threshold, -1 if unsupported
+    int charge_limit_denied;    // A write failed, don't retry until the handles are reopened
+} BatteryHandle;
+
+// Open "online" attribute of an AC adapter
+typedef struct {
+    char path[256];
+    int online_fd;
+} MainsHandle;
+
+// Cached power supply set, rebuilt only at startup and on power_supply hotplug
+static BatteryHandle battery_handles[MAX_BATTERIES];
+static int battery_count = 0;
+static MainsHandle mains_handles[MAX_MAINS];
+static int mains_count = 0;
+static int battery_handles_stale = 1;  // Set on hotplug, supplies rescanned on next read
+
+// Thresholds a battery had before the charge limit first took it over, keyed by path
+// so a handle rescan doesn't mistake our own band for them
+typedef struct {
+    char path[256];
+    int start;                  // -1 if the battery has no start threshold
+    int end;
+} ChargeThresholds;
+
+static ChargeThresholds charge_originals[MAX_BATTERIES];
+static int charge_original_count = 0;
+
+// On-disk history: a fixed header followed by a ring of fixed-width records,
+// memory-mapped so a sample is a plain store into the page cache
+typedef enum {
+    HISTORY_DISCHARGING,
+    HISTORY_CHARGING,
+    HISTORY_FULL,
+    HISTORY_NOT_CHARGING,
+    HISTORY_UNKNOWN
+} HistoryState;
+
+typedef struct {
+    gint64 timestamp;           // Wall clock, microseconds since the epoch
+    gint32 capacity;            // Percent
+    gint32 energy;              // uWh (or uAh), 0 if unknown
+    gint32 power;               // uW (or uA), 0 if unknown
+    gint32 time_remaining;      // Minutes, 0 if unknown
+    guint8 state;               // HistoryState
+    guint8 ac_online;
+    guint8 reserved[6];
+} HistoryRecord;                // 32 bytes, two per cache line
+
+typedef struct {
+    guint32 magic;
+    guint32 version;
+    guint32 record_size;
+    guint32 capacity;           // Records in the ring
+    guint64 head;               // Total records ever written; next slot is head % capacity
+    guint64 exported;           // Records before this were uploaded by the telemetry exporter
+    guint8 reserved[32];
+} HistoryHeader;                // 64 bytes, so records stay cache-line aligned
+
+// Published state for other local tools, fixed-width so any language can map it
+typedef struct {
+    gint32 present;
+    gint32 percentage;
+    gint32 charging;
+    gint32 ac_online;
+    gint32 battery_count;
+    gint32 time_remaining;      // Minutes from the smoothed draw, 0 if unknown
+    gint32 shutdown_seconds;    // Discharge model prediction, 0 if unknown
+    gint32 low;                 // At or past the warning threshold
+    gint32 critical;            // At or past the critical threshold
+    gint32 warning_level;
+    gint32 critical_level;
+    gint32 reserved;
+    gint64 energy_now;
+    gint64 energy_full;
+    gint64 power_now;
+    gint64 smoothed_power;
+    char status[32];
+} StatusSnapshot;
+
+typedef struct {
+    guint32 magic;
+    guint32 version;
+    guint32 size;               // sizeof(StatusSegment), for readers built against another version
+    guint32 sequence;           // Seqlock: odd while the snapshot is being written
+    gint64 changed;             // Wall clock (us) the snapshot last changed
+    StatusSnapshot snapshot;
+} StatusSegment;
+
+// Self-instrumentation. Every update is one relaxed atomic, cheap enough for the hot
+// path and safe from worker threads.
+typedef struct {
+    guint64 ticks;                  // Battery checks run
+    guint64 timer_wakeups;          // Checks started by the timer
+    guint64 uevents;                // power_supply uevent bursts handled
+    guint64 sysfs_reads;            // pread() calls on sysfs attributes
+    guint64 tray_updates;           // Icon or tooltip changes pushed to the panel
+    guint64 notifications;          // Notifications handed to the server
+    guint64 suspend_attempts;       // Suspend backends tried
+    guint64 suspend_failures;       // Requests where every backend failed
+    guint64 suspend_latency_last_us; // Request to backend acknowledgement
+    guint64 suspend_latency_max_us;
+    guint64 tick_latency_total_us;
+    guint64 tick_latency_max_us;
+    guint64 max_stall_us;           // Longest any of our callbacks held the main loop
+} MonitorStats;
+
+static MonitorStats monitor_stats = {0};
+
+#define STAT_INC(field) __atomic_fetch_add(&monitor_stats.field, 1, __ATOMIC_RELAXED)
+#define STAT_ADD(field, n) __atomic_fetch_add(&monitor_stats.field, (n), __ATOMIC_RELAXED)
+#define STAT_SET(field, n) __atomic_store_n(&monitor_stats.field, (n), __ATOMIC_RELAXED)
+
+// Raise a high-water mark without a lock
+static inline void stat_max(guint64 *field, guint64 value) {
+    guint64 seen = __atomic_load_n(field, __ATOMIC_RELAXED);
+    while (value > seen &&
+           !__atomic_compare_exchange_n(field, &seen, value, TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+#define STAT_MAX(field, n) stat_max(&monitor_stats.field, (n))
+
+// Names the counters are exported under
+#define STAT_FIELD(name) { #name, G_STRUCT_OFFSET(MonitorStats, name) }
+
+static const struct {
+    const char *name;
+    size_t offset;
+} stat_fields[] = {
+    STAT_FIELD(ticks),
+    STAT_FIELD(timer_wakeups),
+    STAT_FIELD(uevents),
+    STAT_FIELD(sysfs_reads),
+    STAT_FIELD(tray_updates),
+    STAT_FIELD(notifications),
+    STAT_FIELD(suspend_attempts),
+    STAT_FIELD(suspend_failures),
+    STAT_FIELD(suspend_latency_last_us),
+    STAT_FIELD(suspend_latency_max_us),
+    STAT_FIELD(tick_latency_total_us),
+    STAT_FIELD(tick_latency_max_us),
+    STAT_FIELD(max_stall_us),
+};
+
+// Session bus identity, shared by every interface the monitor exports
+#define DBUS_SERVICE_NAME "org.coollittlebattery"
+#define DBUS_OBJECT_PATH "/org/coollittlebattery"
+
+static guint dbus_owner_id = 0;
+static GDBusNodeInfo *dbus_introspection = NULL;
+static GDBusConnection *dbus_connection = NULL;  // Set while the name's connection is up, for signals
+
+// Snooze from org.coollittlebattery.Monitor, holding back warning-level alerts
+#define MAX_SNOOZE_SECONDS (24 * 3600)
+
+static gint64 alert_snooze_until = 0;        // monitor_clock() the snooze ends at, 0 if none
+static guint64 alert_snooze_until_wall = 0;  // Same moment in wall clock seconds, for clients
+
+// Process attribution tables, only filled while the battery is low
+typedef struct {
+    int pid;                    // 0 marks an empty slot
+    unsigned long long cpu;     // utime + stime in clock ticks
+    unsigned long long start;   // starttime, tells a reused PID apart
+} ProcessSample;
+
+typedef struct {
+    int pid;
+    char comm[16];
+    unsigned long long cpu_delta;
+    double cpu_percent;
+    double watts;               // RAPL share, -1 when unavailable
+} ProcessUsage;
+
+static ProcessSample process_tables[2][PROCESS_TABLE_SIZE];
+static int process_table_current = 0;
+static int process_sampler_primed = 0;
+static gint64 process_sample_time = 0;
+static long long process_rapl_energy = -1;
+static ProcessUsage top_processes[TOP_PROCESS_COUNT];
+static int top_process_count = 0;
+
+// Warning-level power saving, with what each action replaced so it can be put back
+#define MAX_EPP_POLICIES 256
+
+typedef struct {
+    char path[300];                 // cpufreq policy directory
+    char value[32];                 // energy_performance_preference before we touched it
+} SavedEpp;
+
+// One EPP batch, handed to the worker and returned as the task's result
+typedef struct {
+    gboolean applying;
+    char value[32];                 // Written to every policy when applying
+    int count;                      // Policies in saved, read by the worker when applying
+    SavedEpp saved[MAX_EPP_POLICIES];
+    int error;                      // errno of the write that failed, 0 if none
+    char error_path[320];
+} EppJob;
+
+static gboolean power_actions_wanted = FALSE;   // Battery is discharging at warning level
+static gboolean power_actions_applied = FALSE;  // State the last finished batch left behind
+static gboolean power_actions_applying = FALSE; // Direction of the batch in flight
+static int power_actions_pending = 0;           // Replies the batch in flight still waits for
+static char saved_power_profile[32] = "";
+static char saved_backlight_device[256] = "";
+static long long saved_backlight = -1;
+static char frozen_units[512] = "";
+static SavedEpp saved_epp[MAX_EPP_POLICIES];
+static int saved_epp_count = 0;
+
+static HistoryHeader *history_header = NULL;
+static HistoryRecord *history_records = NULL;
+static size_t history_map_size = 0;
+static StatusSegment *status_segment = NULL;
+static int status_segment_fd = -1;     // Kept open for its flock while we publish
+
+// Where power supplies are enumerated; --sysfs-root points it at a fake tree
+static char sysfs_root[256] = "/sys/class/power_supply";
+static int sysfs_root_override = 0;
+
+// Replay harness: scheduling mode under test and the knobs from the command line
+typedef struct {
+    const char *name;
+    int event_driven;
+    int adaptive_interval;
+} HarnessMode;
+
+typedef struct {
+    int speed;                  // Trace seconds per real second, 0 = unpaced
+    int expect_warning;         // Sample index the first warning must fire at, -1 = unchecked
+    int expect_suspend;         // Sample index the suspend decision must happen at, -1 = unchecked
+    const char *mode;           // Only run this mode, NULL = all of them
+} HarnessOptions;
+
+static int harness_active = 0;                     // Alerts and suspends recorded, not carried out
+static gint64 harness_clock = 0;                   // Virtual time (us) from the trace
+static const BatteryStatus *harness_status = NULL; // Injected sample, NULL to read sysfs
+static guint64 harness_sample = 0;
+static gint64 harness_next_check = 0;              // When the scheduler asked to be woken
+static gint64 harness_warning_sample = -1;
+static gint64 harness_critical_sample = -1;
+static gint64 harness_suspend_sample = -1;
+
+// Status window, kept alive while hidden along with a cached surface holding the drawn graph
+static GtkWidget *status_window = NULL;
+static GtkWidget *status_label = NULL;
+static GtkWidget *status_graph = NULL;
+static cairo_surface_t *graph_surface = NULL;
+static int graph_width = 0;
+static int graph_height = 0;
+static gint64 graph_origin = 0;         // Timestamp at x=0
+static guint64 graph_drawn_head = 0;    // History records before this are already on the surface
+static double graph_last_x = 0;
+static double graph_last_y = 0;
+static gint64 graph_last_time = 0;      // 0 until the first point is placed
+
+// What the tray currently shows, so unchanged state isn't pushed to the panel again
+static char tray_shown_icon[256] = "";
+static char tray_shown_tooltip[256] = "";
+
+// Icon pixbuf resolved once per state at the tray's current size
+typedef struct {
+    char name[256];
+    gint size;
+    GdkPixbuf *pixbuf;
+} TrayIconCacheEntry;
+
+static TrayIconCacheEntry tray_icon_cache[TRAY_ICON_CACHE_SIZE];
+static int tray_icon_cache_next = 0;
+
+// Notification categories; repeat alerts of one category replace its bubble in place
+typedef enum {
+    NOTIFY_CLASS_CRITICAL,
+    NOTIFY_CLASS_WARNING,
+    NOTIFY_CLASS_INFO,
+    NOTIFY_CLASS_COUNT
+} NotifyClass;
+
+typedef struct {
+    guint32 id;                        // Server id of the bubble, sent back as replaces_id
+    char title[256];
+    char message[1024];
+    int critical;                      // Critical urgency and alert_timeout
+    int pending;                       // Queued for the next show
+} NotificationSlot;
+
+static NotificationSlot notification_slots[NOTIFY_CLASS_COUNT];
+static int notification_in_flight = 0;
+static GDBusProxy *notify_proxy = NULL;  // org.freedesktop.Notifications, made on the first alert
+static int notify_proxy_pending = 0;
+
+// Log sink and rate limiter state
+typedef struct {
+    char key[32];               // Empty marks a free slot
+    gint64 window_start;        // Monotonic time the current window opened
+    int count;                  // Entries let through in this window
+    int suppressed;             // Entries dropped in this window
+} LogRateLimit;
+
+static int log_max_priority = LOG_INFO;
+static int log_journal_fd = -1;
+static FILE *log_file = NULL;
+static LogRateLimit log_limits[LOG_RATE_SLOTS];
+
 // Function prototypes
 static void load_config(void);
 static void save_config(void);
+static gboolean parse_config_file(BatteryConfig *target);
+static gboolean validate_config(const BatteryConfig *candidate);
+static int config_changed_effects(const BatteryConfig *old);
+static void apply_config_changes(const BatteryConfig *old);
+static void reload_config(void);
+static void setup_config_watch(void);
+static void teardown_config_watch(void);
+static gboolean on_config_changed(gint fd, GIOCondition condition, gpointer user_data);
 static BatteryStatus get_battery_status(void);
+static void open_battery_handles(void);
+static void close_battery_handles(void);
+static int run_sysfs_benchmark(int samples);
+static gint64 monitor_clock(void);
+static int run_replay_harness(const char *trace_path, const HarnessOptions *options);
+static void open_history(void);
+static void close_history(void);
+static void history_append(const BatteryStatus *status);
+static guint64 history_head(void);
+static guint64 history_count(void);
+static const HistoryRecord *history_get(guint64 index);
+static void open_status_segment(void);
+static void close_status_segment(void);
+static void publish_status(const BatteryStatus *status);
+static int run_status_client(void);
+static void emit_monitor_changes(void);
+static void emit_monitor_config_changes(void);
+static void maybe_export_telemetry(const BatteryStatus *status);
+static void read_charge_thresholds(BatteryHandle *bat);
+static void update_charge_limit(const BatteryStatus *status);
+static void set_charge_travel_override(gboolean active);
+static void on_travel_toggled(GtkCheckMenuItem *item, gpointer data);
+static void update_process_attribution(const BatteryStatus *status);
+static void format_top_processes(char *buf, size_t size);
+static void start_power_actions(gboolean apply);
+static void update_power_actions(gboolean low_on_battery);
+static gboolean restore_power_actions(void);
+static void format_status_info(BatteryStatus status, char *info, size_t size);
+static gboolean append_graph_samples(void);
+static void rebuild_graph_surface(GtkWidget *widget);
+static void release_graph_surface(void);
+static gboolean on_graph_draw(GtkWidget *widget, cairo_t *cr, gpointer data);
+static void refresh_status_window(BatteryStatus status);
 static void update_tray_icon(BatteryStatus status);
-static void show_notification(const char *title, const char *message, const char *urgency);
+static void clear_tray_icon_cache(void);
+static gboolean on_tray_size_changed(GtkStatusIcon *status_icon, gint size, gpointer data);
+static void on_icon_theme_changed(GtkIconTheme *theme, gpointer data);
+static void show_notification(NotifyClass category, const char *title, const char *message, const char *urgency);
 static void show_impossible_alert(const char *title, const char *message);
+static void hide_impossible_alert(void);
+static void on_alert_response(GtkDialog *dialog, gint response_id, gpointer data);
 static void force_system_suspend(void);
+static void setup_logind_proxy(void);
+static void request_system_suspend(int method, gboolean with_fallbacks);
+static void try_next_suspend_method(void);
+static gboolean probe_systemctl(void);
+static gboolean probe_pm_utils(void);
+static gboolean probe_logind(void);
+static gboolean probe_kernel(void);
+static gboolean suspend_via_systemctl(void);
+static gboolean suspend_via_pm_utils(void);
+static gboolean suspend_via_logind(void);
+static gboolean suspend_via_kernel(void);
+static void probe_suspend_backends(void);
+static void arm_hibernate_wake(int percentage);
+static int battery_needs_hibernate(const BatteryStatus *status);
+static void request_hibernate(void);
+static void handle_resume(void);
+static void acquire_sleep_inhibitor(void);
+static void release_sleep_inhibitor(void);
+static void run_critical_sequence(gboolean then_suspend);
+static void on_logind_signal(GDBusProxy *proxy, gchar *sender, gchar *signal_name,
+                             GVariant *parameters, gpointer data);
+static void run_battery_check(void);
 static gboolean check_battery_timer(gpointer data);
+static void restart_battery_timer(void);
+static gboolean battery_timer_fired(gpointer data);
+static void update_discharge_rate(BatteryStatus status);
+static int compute_check_delay(void);
+static void estimate_time_remaining(BatteryStatus *status);
+static void format_time_remaining(int minutes, char *buf, size_t size);
+static void open_discharge_model(void);
+static void observe_discharge_model(const BatteryStatus *status);
+static int predict_shutdown_seconds(const BatteryStatus *status);
+static int battery_is_critical(const BatteryStatus *status);
+static int battery_is_low(const BatteryStatus *status);
+static int battery_critical_within(const BatteryStatus *status, int margin);
+static int battery_low_within(const BatteryStatus *status, int margin);
+static gboolean update_alert_state(const BatteryStatus *status, gint64 now);
+static int alert_debounce_remaining(void);
+static gboolean setup_uevent_monitor(void);
+static void teardown_uevent_monitor(void);
+static gboolean on_uevent(gint fd, GIOCondition condition, gpointer user_data);
+static gboolean uevent_idle_check(gpointer data);
+static void start_critical_grace(void);
+static void cancel_critical_grace(void);
+static gboolean critical_grace_expired(gpointer data);
 static void create_menu(void);
 static void on_quit_clicked(GtkMenuItem *item, gpointer data);
 static void on_settings_clicked(GtkMenuItem *item, gpointer data);
@@ -64,7 +679,32 @@ static void on_test_suspend_clicked(GtkMenuItem *item, gpointer data);
 static gboolean test_suspend_callback(gpointer data);
 static void on_tray_popup(GtkStatusIcon *status_icon, guint button, guint32 activate_time, gpointer user_data);
 static void setup_signal_handlers(void);
-static void signal_handler(int sig);
+static gboolean on_quit_signal(gpointer data);
+static void quit_main_loop(void);
+static void finish_quit(void);
+static void open_logger(void);
+static void close_logger(void);
+static void log_write(int priority, const char *key, const char *func, const char *format, ...) G_GNUC_PRINTF(4, 5);
+
+// Leveled logging. A key rate-limits the entries sharing it, for messages a flapping
+// battery could repeat; debug entries vanish entirely from NDEBUG builds.
+#define log_critical(key, ...) log_write(LOG_CRIT, key, __func__, __VA_ARGS__)
+#define log_error(key, ...) log_write(LOG_ERR, key, __func__, __VA_ARGS__)
+#define log_warning(key, ...) log_write(LOG_WARNING, key, __func__, __VA_ARGS__)
+#define log_info(key, ...) log_write(LOG_INFO, key, __func__, __VA_ARGS__)
+#ifdef NDEBUG
+#define log_debug(key, ...) ((void)0)
+#else
+#define log_debug(key, ...) log_write(LOG_DEBUG, key, __func__, __VA_ARGS__)
+#endif
+static void report_startup_metrics(void);
+static double process_age_ms(void);
+static void on_tray_embedded(GObject *object, GParamSpec *pspec, gpointer data);
+static gboolean finish_startup(gpointer data);
+static GVariant *build_stats_variant(void);
+static void setup_dbus_service(void);
+static void teardown_dbus_service(void);
+static int run_stats_client(void);
 
 // Default configuration
 static void init_default_config(void) {
@@ -75,11 +715,38 @@ static void init_default_config(void) {
     config.force_suspend = 1;
     config.impossible_alerts = 1;
     config.suspend_method = 0;  // Default to systemctl
+    config.event_driven = 1;
+    config.fallback_interval = 120;
+    config.adaptive_interval = 1;
+    config.warning_minutes = 0;
+    config.critical_minutes = 0;
+    config.critical_seconds = 180;
+    config.hysteresis_percent = 2;
+    config.alert_debounce = 10;
+    config.charger_debounce = 2;
+    config.warning_repeat = 120;
+    config.critical_repeat = 30;
+    config.hibernate_level = 5;
+    config.hibernate_method = 0;
+    config.charge_limit = 0;
+    config.charge_start_threshold = 75;
+    config.charge_end_threshold = 80;
+    config.charge_full_schedule[0] = '\0';
+    config.process_attribution = 1;
+    config.telemetry_url[0] = '\0';
+    config.telemetry_interval = 60;
+    config.log_level = LOG_INFO;
+    config.log_file[0] = '\0';
+    config.action_power_profile[0] = '\0';
+    config.action_backlight = 0;
+    config.action_pause_units[0] = '\0';
+    config.action_epp[0] = '\0';
     
     // Set default icon paths
     strcpy(config.icon_charging, "battery-caution-charging");
     strcpy(config.icon_battery, "battery-good");
     strcpy(config.icon_low, "battery-caution");
+    config.pre_suspend_hook[0] = '\0';
     
     // Set config file path
     char *home = getenv("HOME");
@@ -91,13 +758,63 @@ static void init_default_config(void) {
     }
 }
 
-// Load configuration from file
-static void load_config(void) {
-    FILE *file = fopen(config.config_path, "r");
-    if (!file) {
-        printf("🔋 No config file found, using defaults\n");
-        return;
-    }
+// Every persisted setting, in file order; load, save and reload all walk this table
+#define CONFIG_INT_KEY(name, effects, min, max, comment) \
+    { #name, CONFIG_INT, G_STRUCT_OFFSET(BatteryConfig, name), sizeof(config.name), effects, min, max, comment }
+#define CONFIG_STRING_KEY(name, effects, comment) \
+    { #name, CONFIG_STRING, G_STRUCT_OFFSET(BatteryConfig, name), sizeof(config.name), effects, 0, 0, comment }
+
+static const ConfigKey config_keys[] = {
+    CONFIG_INT_KEY(warning_level, CONFIG_EFFECT_RECHECK, 5, 95, "Warning level percentage (when to show alerts)"),
+    CONFIG_INT_KEY(critical_level, CONFIG_EFFECT_RECHECK, 1, 50, "Critical level percentage (when to force suspend)"),
+    CONFIG_INT_KEY(check_interval, CONFIG_EFFECT_TIMER, 10, 300, "Check interval in seconds"),
+    CONFIG_INT_KEY(alert_timeout, 0, 0, 3600, "Alert timeout in seconds"),
+    CONFIG_INT_KEY(force_suspend, 0, 0, 1, "Force suspend at critical level (1=yes, 0=no)"),
+    CONFIG_INT_KEY(impossible_alerts, 0, 0, 1, "Show impossible to dismiss alerts (1=yes, 0=no)"),
+    CONFIG_INT_KEY(suspend_method, 0, 0, 3, "Suspend method (0=systemctl, 1=pm-suspend, 2=dbus, 3=kernel)"),
+    CONFIG_INT_KEY(event_driven, CONFIG_EFFECT_EVENTS | CONFIG_EFFECT_TIMER, 0, 1,
+                   "React to kernel battery events instead of polling (1=yes, 0=no)"),
+    CONFIG_INT_KEY(fallback_interval, CONFIG_EFFECT_TIMER, 10, 3600, "Safety-net check interval in seconds while event-driven"),
+    CONFIG_INT_KEY(adaptive_interval, CONFIG_EFFECT_TIMER, 0, 1, "Schedule checks from the discharge rate (1=yes, 0=fixed interval)"),
+    CONFIG_INT_KEY(warning_minutes, CONFIG_EFFECT_RECHECK, 0, 600,
+                   "Also warn / force suspend when this many minutes remain (0=percentage only)"),
+    CONFIG_INT_KEY(critical_minutes, CONFIG_EFFECT_RECHECK, 0, 600, NULL),
+    CONFIG_INT_KEY(critical_seconds, CONFIG_EFFECT_RECHECK, 0, 3600,
+                   "Force suspend when the learned discharge curve predicts this many seconds left (0=off)"),
+    CONFIG_INT_KEY(hysteresis_percent, CONFIG_EFFECT_RECHECK, 0, 50,
+                   "Percent past a threshold before its alerts stop (hysteresis)"),
+    CONFIG_INT_KEY(alert_debounce, 0, 0, 3600, "Seconds a battery / charger state must hold before alerts react"),
+    CONFIG_INT_KEY(charger_debounce, 0, 0, 3600, NULL),
+    CONFIG_INT_KEY(warning_repeat, 0, 1, 86400, "Seconds between repeated warning / critical alerts"),
+    CONFIG_INT_KEY(critical_repeat, 0, 1, 3600, NULL),
+    CONFIG_INT_KEY(hibernate_level, 0, 0, 100, "Hibernate when a critical suspend wakes below this percentage (0=never)"),
+    CONFIG_INT_KEY(hibernate_method, 0, 0, 2, "Hibernate method (0=hibernate, 1=suspend-then-hibernate, 2=hybrid-sleep)"),
+    CONFIG_STRING_KEY(icon_charging, CONFIG_EFFECT_ICONS, "Icon paths"),
+    CONFIG_STRING_KEY(icon_battery, CONFIG_EFFECT_ICONS, NULL),
+    CONFIG_STRING_KEY(icon_low, CONFIG_EFFECT_ICONS, NULL),
+    CONFIG_STRING_KEY(pre_suspend_hook, 0, "Command to run before a critical suspend (empty = none)"),
+    CONFIG_INT_KEY(charge_limit, CONFIG_EFFECT_CHARGE, 0, 1, "Hold the battery between two charge levels to reduce wear (1=yes, 0=no)"),
+    CONFIG_INT_KEY(charge_start_threshold, CONFIG_EFFECT_CHARGE, 0, 100, NULL),
+    CONFIG_INT_KEY(charge_end_threshold, CONFIG_EFFECT_CHARGE, 0, 100, NULL),
+    CONFIG_STRING_KEY(charge_full_schedule, CONFIG_EFFECT_CHARGE,
+                      "Times the battery may charge to 100% (HH:MM-HH:MM, comma separated)"),
+    CONFIG_INT_KEY(process_attribution, 0, 0, 1, "Name the processes draining the battery in low battery alerts (1=yes, 0=no)"),
+    CONFIG_STRING_KEY(telemetry_url, 0, "Upload battery history in batches to this http(s) URL (empty = disabled)"),
+    CONFIG_INT_KEY(telemetry_interval, 0, 1, 10080, "Minutes between telemetry uploads"),
+    CONFIG_INT_KEY(log_level, CONFIG_EFFECT_LOG, 0, 7, "Log level (3=errors, 4=warnings, 6=info, 7=debug)"),
+    CONFIG_STRING_KEY(log_file, CONFIG_EFFECT_LOG, "Log to this file instead of the journal/stdout (empty = default)"),
+    CONFIG_STRING_KEY(action_power_profile, 0, "Power saving at warning level, undone on charger connect (empty/0 = skip)"),
+    CONFIG_INT_KEY(action_backlight, 0, 0, 100, NULL),
+    CONFIG_STRING_KEY(action_pause_units, 0, NULL),
+    CONFIG_STRING_KEY(action_epp, 0, NULL),
+};
+
+#define CONFIG_KEY_COUNT (sizeof(config_keys) / sizeof(config_keys[0]))
+
+// Parse the file into target in one pass; returns FALSE if it can't be opened
+static gboolean parse_config_file(BatteryConfig *target) {
+    FILE *file = fopen(target->config_path, "r");
+    if (!file) return FALSE;
     
     char line[512];
     while (fgets(line, sizeof(line), file)) {
@@ -107,330 +824,3647 @@ static void load_config(void) {
         // Skip comments and empty lines
         if (line[0] == '#' || line[0] == '\0') continue;
         
-        char key[256], value[256];
-        if (sscanf(line, "%255[^=]=%255s", key, value) == 2) {
-            if (strcmp(key, "warning_level") == 0) {
-                config.warning_level = atoi(value);
-            } else if (strcmp(key, "critical_level") == 0) {
-                config.critical_level = atoi(value);
-            } else if (strcmp(key, "check_interval") == 0) {
-                config.check_interval = atoi(value);
-            } else if (strcmp(key, "alert_timeout") == 0) {
-                config.alert_timeout = atoi(value);
-            } else if (strcmp(key, "force_suspend") == 0) {
-                config.force_suspend = atoi(value);
-            } else if (strcmp(key, "impossible_alerts") == 0) {
-                config.impossible_alerts = atoi(value);
-            } else if (strcmp(key, "suspend_method") == 0) {
-                config.suspend_method = atoi(value);
-            } else if (strcmp(key, "icon_charging") == 0) {
-                strcpy(config.icon_charging, value);
-            } else if (strcmp(key, "icon_battery") == 0) {
-                strcpy(config.icon_battery, value);
-            } else if (strcmp(key, "icon_low") == 0) {
-                strcpy(config.icon_low, value);
+        char *value = strchr(line, '=');
+        if (!value) continue;
+        *value++ = '\0';
+        
+        // Spaces around either side and a CRLF's \r would otherwise end up in string values
+        const char *name = g_strstrip(line);
+        value = g_strstrip(value);
+        
+        for (size_t i = 0; i < CONFIG_KEY_COUNT; i++) {
+            const ConfigKey *key = &config_keys[i];
+            if (strcmp(name, key->name) != 0) continue;
+            
+            char *field = (char *)target + key->offset;
+            if (key->type == CONFIG_INT) {
+                // Not a number: keep what was there, like any other line we can't use
+                char *end;
+                errno = 0;
+                long number = strtol(value, &end, 10);
+                if (end == value || *end != '\0' || errno == ERANGE || number < G_MININT || number > G_MAXINT) {
+                    log_warning(NULL, "❌ Ignoring %s=%s in %s, not a number", name, value, target->config_path);
+                } else {
+                    *(int *)field = (int)number;
+                }
+            } else {
+                g_strlcpy(field, value, key->size);
             }
+            break;
         }
     }
     
     fclose(file);
-    printf("🔋 Configuration loaded from %s\n", config.config_path);
+    return TRUE;
 }
 
-// Save configuration to file
-static void save_config(void) {
-    // Create config directory if it doesn't exist
-    char *config_dir = strdup(config.config_path);
-    char *last_slash = strrchr(config_dir, '/');
-    if (last_slash) {
-        *last_slash = '\0';
-        mkdir(config_dir, 0755);
+// The file skips the settings dialog's spin ranges, so a hand or centrally edited value
+// could stall the check timer or wedge the alert state machine; FALSE names the first bad key
+static gboolean validate_config(const BatteryConfig *candidate) {
+    for (size_t i = 0; i < CONFIG_KEY_COUNT; i++) {
+        const ConfigKey *key = &config_keys[i];
+        if (key->type != CONFIG_INT) continue;
+        
+        int value = *(const int *)((const char *)candidate + key->offset);
+        if (value < key->min || value > key->max) {
+            log_warning(NULL, "❌ %s=%d in %s is outside %d-%d", key->name, value,
+                        candidate->config_path, key->min, key->max);
+            return FALSE;
+        }
     }
-    free(config_dir);
-    
-    FILE *file = fopen(config.config_path, "w");
-    if (!file) {
-        printf("❌ Failed to save config to %s: %s\n", config.config_path, strerror(errno));
-        return;
-    }
-    
-    fprintf(file, "# 🔋 Cool Little Battery Monitor Configuration\n");
-    fprintf(file, "# Warning level percentage (when to show alerts)\n");
-    fprintf(file, "warning_level=%d\n", config.warning_level);
-    fprintf(file, "# Critical level percentage (when to force suspend)\n");
-    fprintf(file, "critical_level=%d\n", config.critical_level);
-    fprintf(file, "# Check interval in seconds\n");
-    fprintf(file, "check_interval=%d\n", config.check_interval);
-    fprintf(file, "# Alert timeout in seconds\n");
-    fprintf(file, "alert_timeout=%d\n", config.alert_timeout);
-    fprintf(file, "# Force suspend at critical level (1=yes, 0=no)\n");
-    fprintf(file, "force_suspend=%d\n", config.force_suspend);
-    fprintf(file, "# Show impossible to dismiss alerts (1=yes, 0=no)\n");
-    fprintf(file, "impossible_alerts=%d\n", config.impossible_alerts);
-    fprintf(file, "# Suspend method (0=systemctl, 1=pm-suspend, 2=dbus, 3=kernel)\n");
-    fprintf(file, "suspend_method=%d\n", config.suspend_method);
-    fprintf(file, "# Icon paths\n");
-    fprintf(file, "icon_charging=%s\n", config.icon_charging);
-    fprintf(file, "icon_battery=%s\n", config.icon_battery);
-    fprintf(file, "icon_low=%s\n", config.icon_low);
     
-    fclose(file);
-    printf("🔋 Configuration saved to %s\n", config.config_path);
+    if (candidate->critical_level >= candidate->warning_level) {
+        log_warning(NULL, "❌ critical_level=%d in %s is not below warning_level=%d",
+                    candidate->critical_level, candidate->config_path, candidate->warning_level);
+        return FALSE;
+    }
+    return TRUE;
 }
 
-// Get current battery status
-static BatteryStatus get_battery_status(void) {
-    BatteryStatus status = {0};
-    
-    // Try to read from /sys/class/power_supply/BAT0 or BAT1
-    const char *battery_paths[] = {
-        "/sys/class/power_supply/BAT0",
-        "/sys/class/power_supply/BAT1",
-        NULL
-    };
-    
-    for (int i = 0; battery_paths[i]; i++) {
-        char path[512];
-        FILE *file;
-        
-        // Check if battery is present
-        snprintf(path, sizeof(path), "%s/present", battery_paths[i]);
-        file = fopen(path, "r");
-        if (!file) continue;
-        
-        int present;
-        if (fscanf(file, "%d", &present) == 1 && present) {
-            status.present = 1;
-            fclose(file);
-            
-            // Read capacity
-            snprintf(path, sizeof(path), "%s/capacity", battery_paths[i]);
-            file = fopen(path, "r");
-            if (file) {
-                fscanf(file, "%d", &status.percentage);
-                fclose(file);
-            }
-            
-            // Read status
-            snprintf(path, sizeof(path), "%s/status", battery_paths[i]);
-            file = fopen(path, "r");
-            if (file) {
-                fgets(status.status, sizeof(status.status), file);
-                // Remove newline
-                status.status[strcspn(status.status, "\n")] = 0;
-                status.charging = (strcmp(status.status, "Charging") == 0);
-                fclose(file);
-            }
-            
-            break;
-        } else {
-            fclose(file);
+// Load configuration from file
+static void load_config(void) {
+    BatteryConfig loaded = config;
+    if (!parse_config_file(&loaded)) {
+        if (errno != ENOENT) {
+            // There is a file, we just can't read it; don't replace it with defaults
+            log_warning(NULL, "❌ Cannot read %s: %s, using defaults", config.config_path, strerror(errno));
+            return;
         }
+        
+        // Write the defaults out right away so there's a file to edit, even if we never
+        // get to exit cleanly; a failed write is retried at exit
+        log_info(NULL, "🔋 No config file found, using defaults");
+        config_dirty = 1;
+        save_config();
+        return;
     }
     
-    return status;
+    // Leave the file alone for the user to fix, the next save replaces it anyway
+    if (!validate_config(&loaded)) {
+        log_warning(NULL, "❌ Ignoring %s, using defaults", config.config_path);
+        return;
+    }
+    config = loaded;
+    log_info(NULL, "🔋 Configuration loaded from %s", config.config_path);
 }
 
-// Update the system tray icon
-static void update_tray_icon(BatteryStatus status) {
-    if (!tray_icon) return;
-    
-    char tooltip[256];
-    const char *icon;
+// Which parts of the running monitor depend on the fields that differ between old and config
+static int config_changed_effects(const BatteryConfig *old) {
+    int effects = 0;
     
-    if (!status.present) {
-        icon = "battery-missing";
-        strcpy(tooltip, "🔋 No battery detected");
-    } else if (status.charging) {
-        icon = config.icon_charging;
-        snprintf(tooltip, sizeof(tooltip), "🔌 Charging: %d%%", status.percentage);
-    } else if (status.percentage <= config.critical_level) {
-        icon = config.icon_low;
-        snprintf(tooltip, sizeof(tooltip), "🚨 CRITICAL: %d%% - GET A CHARGER NOW!", status.percentage);
-    } else if (status.percentage <= config.warning_level) {
-        icon = config.icon_low;
-        snprintf(tooltip, sizeof(tooltip), "⚠️ Low: %d%% - Consider charging", status.percentage);
-    } else {
-        icon = config.icon_battery;
-        snprintf(tooltip, sizeof(tooltip), "🔋 Battery: %d%%", status.percentage);
+    for (size_t i = 0; i < CONFIG_KEY_COUNT; i++) {
+        const ConfigKey *key = &config_keys[i];
+        const char *before = (const char *)old + key->offset;
+        const char *after = (const char *)&config + key->offset;
+        
+        gboolean differs = key->type == CONFIG_INT ?
+            memcmp(before, after, key->size) != 0 : strcmp(before, after) != 0;
+        if (differs) effects |= key->effects | CONFIG_EFFECT_CHANGED;
     }
     
-    gtk_status_icon_set_from_icon_name(tray_icon, icon);
-    gtk_status_icon_set_tooltip_text(tray_icon, tooltip);
+    return effects;
 }
 
-// Show desktop notification
-static void show_notification(const char *title, const char *message, const char *urgency) {
-    if (!notify_is_initted()) {
-        if (!notify_init("Cool Little Battery Monitor")) {
-            printf("❌ Failed to initialize libnotify\n");
-            return;
+// Bring the running monitor in line with config after it moved away from old
+static void apply_config_changes(const BatteryConfig *old) {
+    int effects = config_changed_effects(old);
+    
+    if (effects & CONFIG_EFFECT_EVENTS) {
+        if (config.event_driven) {
+            setup_uevent_monitor();
+        } else {
+            teardown_uevent_monitor();
         }
     }
     
-    NotifyNotification *notification = notify_notification_new(title, message, "battery-caution");
+    if (effects & CONFIG_EFFECT_ICONS) {
+        clear_tray_icon_cache();
+        update_tray_icon(last_status);
+    }
     
-    // Set urgency
-    if (strcmp(urgency, "critical") == 0) {
-        notify_notification_set_urgency(notification, NOTIFY_URGENCY_CRITICAL);
-        notify_notification_set_timeout(notification, config.alert_timeout * 1000);
-    } else {
-        notify_notification_set_urgency(notification, NOTIFY_URGENCY_NORMAL);
-        notify_notification_set_timeout(notification, 5000);
+    if (effects & CONFIG_EFFECT_LOG) {
+        open_logger();
     }
     
-    notify_notification_show(notification, NULL);
-    g_object_unref(notification);
-}
-
-// Show impossible to dismiss alert dialog
-static void show_impossible_alert(const char *title, const char *message) {
-    if (!config.impossible_alerts) return;
+    if (effects & CONFIG_EFFECT_CHARGE) {
+        for (int i = 0; i < battery_count; i++) {
+            battery_handles[i].charge_limit_denied = 0;
+        }
+        // Without a limit there's nothing for a travel charge to override
+        if (!config.charge_limit && charge_travel_override) set_charge_travel_override(FALSE);
+        if (travel_item) gtk_widget_set_sensitive(travel_item, config.charge_limit);
+        update_charge_limit(&last_status);
+    }
     
-    // Close any existing alert
-    if (alert_dialog) {
-        gtk_widget_destroy(alert_dialog);
-        alert_dialog = NULL;
+    // A recheck reschedules the timer itself after evaluating the new thresholds
+    if (effects & CONFIG_EFFECT_RECHECK) {
+        check_battery_timer(NULL);
+    } else if (effects & CONFIG_EFFECT_TIMER) {
+        restart_battery_timer();
     }
     
-    alert_dialog = gtk_message_dialog_new(NULL,
-                                        GTK_DIALOG_MODAL | GTK_DIALOG_DESTROY_WITH_PARENT,
-                                        GTK_MESSAGE_WARNING,
-                                        GTK_BUTTONS_OK,
-                                        "%s", title);
+    // Clients watching Config or the thresholds
+    emit_monitor_config_changes();
+}
+
+// Re-read the file after an outside edit, keeping the current settings if it vanished
+// or fails validation
+static void reload_config(void) {
+    BatteryConfig old = config;
     
-    gtk_message_dialog_format_secondary_text(GTK_MESSAGE_DIALOG(alert_dialog), "%s", message);
+    init_default_config();
+    BatteryConfig loaded = config;
+    config = old;
+    if (!parse_config_file(&loaded)) return;
+    if (!validate_config(&loaded)) {
+        log_warning(NULL, "❌ Keeping the running configuration, %s was not applied", old.config_path);
+        return;
+    }
+    config = loaded;
     
-    // Make it stay on top and grab focus
-    gtk_window_set_keep_above(GTK_WINDOW(alert_dialog), TRUE);
-    gtk_window_set_urgency_hint(GTK_WINDOW(alert_dialog), TRUE);
-    gtk_window_set_position(GTK_WINDOW(alert_dialog), GTK_WIN_POS_CENTER_ALWAYS);
+    // The file on disk wins over anything not yet saved
+    config_dirty = 0;
     
-    // Show the dialog and wait for response
-    gint result = gtk_dialog_run(GTK_DIALOG(alert_dialog));
-    gtk_widget_destroy(alert_dialog);
-    alert_dialog = NULL;
+    // Our own saves land here too and come out identical
+    if (!(config_changed_effects(&old) & CONFIG_EFFECT_CHANGED)) return;
     
-    alert_active = 1;
+    log_info(NULL, "🔋 Configuration reloaded from %s", config.config_path);
+    apply_config_changes(&old);
 }
 
-// Force system suspend
-static void force_system_suspend(void) {
-    printf("🚨 FORCING SYSTEM SUSPEND DUE TO CRITICAL BATTERY! 🚨\n");
+// Watch the config directory, since editors and config management replace the file by rename
+static void setup_config_watch(void) {
+    char *dir = g_path_get_dirname(config.config_path);
     
-    // Show final warning
-    show_notification("🚨 SYSTEM SUSPENDING NOW! 🚨", 
-                     "Battery critically low! Suspending to prevent data loss!", 
-                     "critical");
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) {
+        log_error(NULL, "❌ Failed to start config watch: %s", strerror(errno));
+        g_free(dir);
+        return;
+    }
     
-    // Suspend using selected method
-    const char *suspend_commands[] = {
-        "systemctl suspend",           // 0: systemd
-        "pm-suspend",                 // 1: pm-utils
-        "dbus-send --system --print-reply --dest=org.freedesktop.login1 /org/freedesktop/login1 \"org.freedesktop.login1.Manager.Suspend\" boolean:true",  // 2: dbus
-        "echo mem > /sys/power/state", // 3: direct kernel interface
-    };
+    if (inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        log_error(NULL, "❌ Failed to watch %s: %s", dir, strerror(errno));
+        close(fd);
+        g_free(dir);
+        return;
+    }
     
-    if (config.suspend_method >= 0 && config.suspend_method < 4) {
-        printf("🔋 Using suspend method: %s\n", suspend_commands[config.suspend_method]);
-        if (system(suspend_commands[config.suspend_method]) != 0) {
-            printf("❌ Primary suspend method failed, trying fallbacks...\n");
-            // Try other methods as fallback
-            for (int i = 0; i < 4; i++) {
-                if (i != config.suspend_method) {
-                    printf("🔋 Trying fallback: %s\n", suspend_commands[i]);
-                    if (system(suspend_commands[i]) == 0) {
-                        break;
-                    }
-                }
-            }
+    config_watch_fd = fd;
+    config_watch_source_id = g_unix_fd_add(fd, G_IO_IN, on_config_changed, NULL);
+    g_free(dir);
+}
+
+static void teardown_config_watch(void) {
+    if (config_watch_source_id) {
+        g_source_remove(config_watch_source_id);
+        config_watch_source_id = 0;
+    }
+    if (config_watch_fd >= 0) {
+        close(config_watch_fd);
+        config_watch_fd = -1;
+    }
+}
+
+static gboolean on_config_changed(gint fd, GIOCondition condition, gpointer user_data) {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    char *name = g_path_get_basename(config.config_path);
+    gboolean ours = FALSE;
+    ssize_t len;
+    
+    // Drain everything queued and reload at most once
+    while ((len = read(fd, buf, sizeof(buf))) > 0) {
+        for (char *ptr = buf; ptr < buf + len; ) {
+            struct inotify_event *event = (struct inotify_event *)ptr;
+            if (event->len && strcmp(event->name, name) == 0) ours = TRUE;
+            ptr += sizeof(struct inotify_event) + event->len;
         }
     }
+    g_free(name);
+    
+    if (ours) reload_config();
+    return G_SOURCE_CONTINUE;
 }
 
-// Battery check timer callback
-static gboolean check_battery_timer(gpointer data) {
-    BatteryStatus status = get_battery_status();
+// Save configuration to file, replacing it atomically so a crash never leaves it truncated
+static void save_config(void) {
+    // Create config directory if it doesn't exist
+    char *config_dir = strdup(config.config_path);
+    char *last_slash = strrchr(config_dir, '/');
+    if (last_slash) {
+        *last_slash = '\0';
+        mkdir(config_dir, 0755);
+    }
+    free(config_dir);
     
-    if (!status.present) {
-        update_tray_icon(status);
-        return TRUE;  // Continue timer
+    GString *contents = g_string_sized_new(1024);
+    g_string_append(contents, "# 🔋 Cool Little Battery Monitor Configuration\n");
+    for (size_t i = 0; i < CONFIG_KEY_COUNT; i++) {
+        const ConfigKey *key = &config_keys[i];
+        const char *field = (const char *)&config + key->offset;
+        
+        if (key->comment) g_string_append_printf(contents, "# %s\n", key->comment);
+        if (key->type == CONFIG_INT) {
+            g_string_append_printf(contents, "%s=%d\n", key->name, *(const int *)field);
+        } else {
+            g_string_append_printf(contents, "%s=%s\n", key->name, field);
+        }
     }
     
-    time_t current_time = time(NULL);
+    char tmp_path[600];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", config.config_path);
     
-    // Update icon always
-    update_tray_icon(status);
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        log_error(NULL, "❌ Failed to save config to %s: %s", tmp_path, strerror(errno));
+        g_string_free(contents, TRUE);
+        return;
+    }
     
-    // Don't alert if charging
-    if (status.charging) {
-        alert_active = 0;
-        if (alert_dialog) {
-            gtk_widget_destroy(alert_dialog);
-            alert_dialog = NULL;
+    size_t written = 0;
+    while (written < contents->len) {
+        ssize_t n = write(fd, contents->str + written, contents->len - written);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
         }
-        last_percentage = status.percentage;
-        last_charging_state = status.charging;
-        return TRUE;
+        written += n;
     }
     
-    // Critical level - FORCE SUSPEND
-    if (status.percentage <= config.critical_level) {
-        if (current_time - last_alert_time > 30) {  // Don't spam suspend
-            char title[256], message[512];
-            snprintf(title, sizeof(title), "🚨 CRITICAL BATTERY: %d%% 🚨", status.percentage);
-            snprintf(message, sizeof(message), 
-                    "Your battery is critically low at %d%%!\n\n"
-                    "🔌 PLUG IN YOUR CHARGER IMMEDIATELY!\n\n"
-                    "System will suspend in 10 seconds to prevent data loss!",
-                    status.percentage);
-            
-            show_notification(title, message, "critical");
-            show_impossible_alert(title, message);
-            
-            if (config.force_suspend) {
-                // Give user 10 seconds to plug in charger
-                sleep(10);
-                
-                // Check again if still critical and not charging
-                BatteryStatus final_check = get_battery_status();
-                if (final_check.percentage <= config.critical_level && !final_check.charging) {
-                    force_system_suspend();
-                }
-            }
-            
-            last_alert_time = current_time;
-        }
+    // Data must be on disk before the rename makes it the live config
+    int failed = written < contents->len || fsync(fd) < 0;
+    int saved_errno = errno;
+    close(fd);
+    g_string_free(contents, TRUE);
+    
+    if (failed || rename(tmp_path, config.config_path) < 0) {
+        if (!failed) saved_errno = errno;
+        log_error(NULL, "❌ Failed to save config to %s: %s", config.config_path, strerror(saved_errno));
+        unlink(tmp_path);
+        return;
     }
-    // Warning level - IMPOSSIBLE TO IGNORE ALERTS
-    else if (status.percentage <= config.warning_level) {
-        if (current_time - last_alert_time > 120) {  // Alert every 2 minutes
-            char title[256], message[512];
-            snprintf(title, sizeof(title), "⚠️ LOW BATTERY: %d%% ⚠️", status.percentage);
-            snprintf(message, sizeof(message), 
-                    "Your battery is getting low at %d%%!\n\n"
-                    "🔌 Please plug in your charger soon!\n\n"
-                    "System will force suspend at %d%% to protect your data!",
-                    status.percentage, config.critical_level);
-            
-            show_notification(title, message, "critical");
-            show_impossible_alert(title, message);
-            
-            last_alert_time = current_time;
-        }
-    } else {
-        // Battery level is good, clear any active alerts
-        alert_active = 0;
-        if (alert_dialog) {
-            gtk_widget_destroy(alert_dialog);
-            alert_dialog = NULL;
-        }
+    
+    config_dirty = 0;
+    log_info(NULL, "🔋 Configuration saved to %s", config.config_path);
+}
+
+// Open one sysfs attribute for repeated pread() calls
+static int open_sysfs_attr(const char *dir, const char *name) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+static void close_fd(int *fd) {
+    if (*fd >= 0) {
+        close(*fd);
+        *fd = -1;
+    }
+}
+
+static void close_battery_handles(void) {
+    for (int i = 0; i < battery_count; i++) {
+        BatteryHandle *bat = &battery_handles[i];
+        close_fd(&bat->present_fd);
+        close_fd(&bat->capacity_fd);
+        close_fd(&bat->status_fd);
+        close_fd(&bat->energy_now_fd);
+        close_fd(&bat->energy_full_fd);
+        close_fd(&bat->power_now_fd);
     }
+    for (int i = 0; i < mains_count; i++) {
+        close_fd(&mains_handles[i].online_fd);
+    }
+    battery_count = 0;
+    mains_count = 0;
+}
+
+// Read a whole sysfs attribute into buf; sysfs regenerates the value on every read at offset 0
+static int read_sysfs_attr(int fd, char *buf, size_t size) {
+    if (fd < 0) return -1;
     
-    last_percentage = status.percentage;
-    last_charging_state = status.charging;
+    STAT_INC(sysfs_reads);
+    ssize_t len;
+    do {
+        len = pread(fd, buf, size - 1, 0);
+    } while (len < 0 && errno == EINTR);
     
-    return TRUE;  // Continue timer
+    if (len < 0) return -1;
+    while (len > 0 && (buf[len - 1] == '\n' || buf[len - 1] == ' ')) len--;
+    buf[len] = '\0';
+    return (int)len;
+}
+
+// Read a small attribute once by path, for enumeration only
+static int read_sysfs_file(const char *dir, const char *name, char *buf, size_t size) {
+    int fd = open_sysfs_attr(dir, name);
+    if (fd < 0) return -1;
+    int len = read_sysfs_attr(fd, buf, size);
+    close(fd);
+    return len;
+}
+
+// (Re)scan the power_supply class, called at startup and after power_supply hotplug
+static void open_battery_handles(void) {
+    close_battery_handles();
+    battery_handles_stale = 0;
+    
+    DIR *dir = opendir(sysfs_root);
+    if (!dir) {
+        log_error(NULL, "❌ Cannot read %s: %s", sysfs_root, strerror(errno));
+        return;
+    }
+    
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        if (entry->d_name[0] == '.') continue;
+        
+        char path[256], type[32], scope[32];
+        snprintf(path, sizeof(path), "%s/%s", sysfs_root, entry->d_name);
+        if (read_sysfs_file(path, "type", type, sizeof(type)) <= 0) continue;
+        
+        if (strcmp(type, "Battery") == 0 && battery_count < MAX_BATTERIES) {
+            // Mice, keyboards and headsets also report "Battery" but with scope=Device
+            if (read_sysfs_file(path, "scope", scope, sizeof(scope)) > 0 && strcmp(scope, "Device") == 0) {
+                continue;
+            }
+            
+            BatteryHandle *bat = &battery_handles[battery_count];
+            snprintf(bat->path, sizeof(bat->path), "%s", path);
+            bat->present_fd = open_sysfs_attr(path, "present");
+            bat->capacity_fd = open_sysfs_attr(path, "capacity");
+            bat->status_fd = open_sysfs_attr(path, "status");
+            bat->energy_now_fd = open_sysfs_attr(path, "energy_now");
+            bat->energy_full_fd = open_sysfs_attr(path, "energy_full");
+            bat->power_now_fd = open_sysfs_attr(path, "power_now");
+            bat->reports_charge = 0;
+            if (bat->energy_now_fd < 0 || bat->energy_full_fd < 0) {
+                close_fd(&bat->energy_now_fd);
+                close_fd(&bat->energy_full_fd);
+                close_fd(&bat->power_now_fd);
+                bat->energy_now_fd = open_sysfs_attr(path, "charge_now");
+                bat->energy_full_fd = open_sysfs_attr(path, "charge_full");
+                bat->power_now_fd = open_sysfs_attr(path, "current_now");
+                bat->reports_charge = 1;
+            }
+            read_charge_thresholds(bat);
+            battery_count++;
+        } else if (strcmp(type, "Mains") == 0 && mains_count < MAX_MAINS) {
+            MainsHandle *mains = &mains_handles[mains_count];
+            snprintf(mains->path, sizeof(mains->path), "%s", path);
+            mains->online_fd = open_sysfs_attr(path, "online");
+            mains_count++;
+        }
+    }
+    closedir(dir);
+    
+    log_info(NULL, "🔋 Found %d battery(s) and %d AC adapter(s)", battery_count, mains_count);
+}
+
+// Parse a decimal sysfs integer without going through stdio
+static int parse_sysfs_int(const char *buf, long long *value) {
+    long long sign = 1, result = 0;
+    
+    if (*buf == '-') {
+        sign = -1;
+        buf++;
+    }
+    if (*buf < '0' || *buf > '9') return 0;
+    while (*buf >= '0' && *buf <= '9') {
+        result = result * 10 + (*buf - '0');
+        buf++;
+    }
+    
+    *value = sign * result;
+    return 1;
+}
+
+static int read_sysfs_int(int fd, long long *value) {
+    char buf[32];
+    return read_sysfs_attr(fd, buf, sizeof(buf)) > 0 && parse_sysfs_int(buf, value);
+}
+
+// Get current battery status, combined over every installed battery
+static BatteryStatus get_battery_status(void) {
+    BatteryStatus status = {0};
+    long long energy_now = 0, energy_full = 0, power_now = 0, capacity_sum = 0;
+    int by_energy = 1, any_charging = 0, any_discharging = 0, units = -1;
+    
+    if (harness_status) {
+        return *harness_status;
+    }
+    
+    if (battery_handles_stale) {
+        open_battery_handles();
+    }
+    
+    for (int i = 0; i < battery_count; i++) {
+        BatteryHandle *bat = &battery_handles[i];
+        long long present = 1, capacity = 0, now, full, power;
+        char state[32];
+        
+        // Batteries without a present attribute are always there
+        if (bat->present_fd >= 0) {
+            char buf[32];
+            if (read_sysfs_attr(bat->present_fd, buf, sizeof(buf)) < 0) {
+                // A battery that vanished under us will be picked up by the next rescan
+                battery_handles_stale = 1;
+                continue;
+            }
+            if (!parse_sysfs_int(buf, &present)) present = 0;
+        }
+        if (!present) continue;
+        
+        status.present = 1;
+        status.battery_count++;
+        
+        // Read capacity
+        read_sysfs_int(bat->capacity_fd, &capacity);
+        capacity_sum += capacity;
+        
+        // Read energy, so packs of different sizes are weighted correctly
+        if (units >= 0 && units != bat->reports_charge) {
+            by_energy = 0;  // Can't add uWh to uAh
+        }
+        units = bat->reports_charge;
+        if (read_sysfs_int(bat->energy_now_fd, &now) && read_sysfs_int(bat->energy_full_fd, &full) && full > 0) {
+            energy_now += now;
+            energy_full += full;
+            // Some drivers report current_now negative while discharging
+            if (read_sysfs_int(bat->power_now_fd, &power)) {
+                power_now += power < 0 ? -power : power;
+            }
+        } else {
+            by_energy = 0;
+        }
+        
+        // Read status; the first battery's status is reported unless another one is charging
+        if (read_sysfs_attr(bat->status_fd, state, sizeof(state)) >= 0) {
+            if (strcmp(state, "Charging") == 0) {
+                any_charging = 1;
+                strcpy(status.status, state);
+            } else if (strcmp(state, "Discharging") == 0) {
+                any_discharging = 1;
+            }
+            if (status.battery_count == 1 && !any_charging) {
+                strcpy(status.status, state);
+            }
+        }
+    }
+    
+    for (int i = 0; i < mains_count; i++) {
+        long long online;
+        if (read_sysfs_int(mains_handles[i].online_fd, &online) && online) {
+            status.ac_online = 1;
+        }
+    }
+    
+    if (status.battery_count > 0) {
+        if (by_energy && energy_full > 0) {
+            status.percentage = (int)((energy_now * 100 + energy_full / 2) / energy_full);
+            status.energy_now = energy_now;
+            status.energy_full = energy_full;
+            status.power_now = power_now;
+        } else {
+            status.percentage = (int)(capacity_sum / status.battery_count);
+        }
+        if (status.percentage > 100) status.percentage = 100;
+    }
+    
+    // Plugged in and nothing draining counts as charging, e.g. when held at a charge limit
+    status.charging = any_charging || (status.ac_online && !any_discharging);
+    
+    return status;
+}
+
+// Charge-limit controller: hold charge_control_{start,end}_threshold at the configured
+// band so docked batteries don't sit at 100%, lifting it inside the scheduled windows
+// or while a travel charge is requested
+static void read_charge_thresholds(BatteryHandle *bat) {
+    char value[32];
+    long long start = -1, end = -1;
+    
+    if (read_sysfs_file(bat->path, "charge_control_start_threshold", value, sizeof(value)) > 0) {
+        parse_sysfs_int(value, &start);
+    }
+    if (read_sysfs_file(bat->path, "charge_control_end_threshold", value, sizeof(value)) > 0) {
+        parse_sysfs_int(value, &end);
+    }
+    bat->charge_start = (int)start;
+    bat->charge_end = (int)end;
+    bat->charge_limit_denied = 0;
+}
+
+static int write_charge_threshold(BatteryHandle *bat, const char *name, int value) {
+    char path[320], text[16];
+    snprintf(path, sizeof(path), "%s/%s", bat->path, name);
+    int len = snprintf(text, sizeof(text), "%d\n", value);
+    
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd < 0 || write(fd, text, len) != len) {
+        // Usually EACCES: these attributes are root-only unless a udev rule opens them up
+        log_error(NULL, "❌ Cannot set %s to %d: %s", path, value, strerror(errno));
+        if (fd >= 0) close(fd);
+        bat->charge_limit_denied = 1;
+        return 0;
+    }
+    close(fd);
+    return 1;
+}
+
+// Bring one battery to the target band, touching sysfs only for values that differ
+static void apply_charge_thresholds(BatteryHandle *bat, int start, int end) {
+    if (bat->charge_end < 0 || bat->charge_limit_denied) return;
+    if (bat->charge_end == end && (bat->charge_start < 0 || bat->charge_start == start)) return;
+    
+    // Drivers reject start >= end, so move whichever side keeps the band valid first
+    gboolean raising = end > bat->charge_end;
+    if (raising && bat->charge_end != end) {
+        if (!write_charge_threshold(bat, "charge_control_end_threshold", end)) return;
+        bat->charge_end = end;
+    }
+    if (bat->charge_start >= 0 && bat->charge_start != start) {
+        if (!write_charge_threshold(bat, "charge_control_start_threshold", start)) return;
+        bat->charge_start = start;
+    }
+    if (!raising && bat->charge_end != end) {
+        if (!write_charge_threshold(bat, "charge_control_end_threshold", end)) return;
+        bat->charge_end = end;
+    }
+    
+    log_info("charge-limit", "🔋 %s now charges between %d%% and %d%%", strrchr(bat->path, '/') + 1,
+           bat->charge_start >= 0 ? bat->charge_start : 0, bat->charge_end);
+}
+
+// Look up what this battery had before we managed it, recording it the first time
+static const ChargeThresholds *remember_charge_thresholds(const BatteryHandle *bat, gboolean record) {
+    for (int i = 0; i < charge_original_count; i++) {
+        if (strcmp(charge_originals[i].path, bat->path) == 0) return &charge_originals[i];
+    }
+    if (!record || bat->charge_end < 0 || charge_original_count >= MAX_BATTERIES) return NULL;
+    
+    ChargeThresholds *original = &charge_originals[charge_original_count++];
+    g_strlcpy(original->path, bat->path, sizeof(original->path));
+    original->start = bat->charge_start;
+    original->end = bat->charge_end;
+    return original;
+}
+
+// Whether the local time falls in one of the "HH:MM-HH:MM" windows, which may wrap midnight
+static gboolean in_charge_full_window(const char *schedule) {
+    time_t now = time(NULL);
+    struct tm local;
+    localtime_r(&now, &local);
+    int minute = local.tm_hour * 60 + local.tm_min;
+    
+    for (const char *window = schedule; window && *window; ) {
+        int h1, m1, h2, m2;
+        if (sscanf(window, " %d:%d-%d:%d", &h1, &m1, &h2, &m2) == 4) {
+            int from = h1 * 60 + m1, to = h2 * 60 + m2;
+            if (from <= to ? (minute >= from && minute < to) : (minute >= from || minute < to)) {
+                return TRUE;
+            }
+        }
+        window = strchr(window, ',');
+        if (window) window++;
+    }
+    return FALSE;
+}
+
+// Evaluated on every check and whenever the settings or the travel override change
+static void update_charge_limit(const BatteryStatus *status) {
+    if (harness_active) return;
+    
+    // The travel charge ends once the battery was full and the charger is pulled, or after a day
+    if (charge_travel_override) {
+        if (status->present && (status->percentage >= 100 || strcmp(status->status, "Full") == 0)) {
+            charge_travel_reached = 1;
+        }
+        if ((charge_travel_reached && !status->ac_online) ||
+            g_get_monotonic_time() - charge_travel_started > (gint64)24 * 3600 * G_USEC_PER_SEC) {
+            set_charge_travel_override(FALSE);
+        }
+    }
+    
+    if (!config.charge_limit && !charge_limit_managed) return;
+    
+    int start = CHARGE_FULL_START, end = 100;
+    if (config.charge_limit && !charge_travel_override && !in_charge_full_window(config.charge_full_schedule)) {
+        end = CLAMP(config.charge_end_threshold, 50, 100);
+        start = CLAMP(config.charge_start_threshold, 0, end - 1);
+    }
+    
+    // After the limit is switched off, every battery gets back what it had before we took
+    // over (a firmware or TLP limit, say); one we never saw is handed back at full charge
+    charge_limit_managed = config.charge_limit;
+    
+    for (int i = 0; i < battery_count; i++) {
+        BatteryHandle *bat = &battery_handles[i];
+        const ChargeThresholds *original = remember_charge_thresholds(bat, config.charge_limit);
+        if (!config.charge_limit && original) {
+            apply_charge_thresholds(bat, original->start, original->end);
+        } else {
+            apply_charge_thresholds(bat, start, end);
+        }
+    }
+    if (!config.charge_limit) charge_original_count = 0;
+}
+
+static void set_charge_travel_override(gboolean active) {
+    charge_travel_override = active;
+    charge_travel_reached = 0;
+    charge_travel_started = g_get_monotonic_time();
+    
+    if (active) {
+        log_info("charge-limit", "🧳 Charging to 100%% for travel");
+    } else {
+        log_info("charge-limit", "🔋 Travel charge finished, back to the charge limit");
+    }
+    
+    // Keep the menu in step when the override ends by itself
+    if (travel_item && gtk_check_menu_item_get_active(GTK_CHECK_MENU_ITEM(travel_item)) != active) {
+        g_signal_handlers_block_by_func(travel_item, on_travel_toggled, NULL);
+        gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(travel_item), active);
+        g_signal_handlers_unblock_by_func(travel_item, on_travel_toggled, NULL);
+    }
+}
+
+static void on_travel_toggled(GtkCheckMenuItem *item, gpointer data) {
+    set_charge_travel_override(gtk_check_menu_item_get_active(item));
+    update_charge_limit(&last_status);
+}
+
+// Per-process attribution: while discharging at warning level, rank processes by CPU
+// time since the previous check, scaled to watts from RAPL where the counters are readable.
+// Each scan builds the other table from this one, so exited PIDs simply aren't carried over.
+static ProcessSample *process_lookup(ProcessSample *table, int pid, gboolean insert) {
+    guint slot = ((guint)pid * 2654435761u) & (PROCESS_TABLE_SIZE - 1);
+    
+    for (int probe = 0; probe < PROCESS_TABLE_SIZE; probe++) {
+        ProcessSample *entry = &table[slot];
+        if (entry->pid == pid) return entry;
+        if (entry->pid == 0) return insert ? entry : NULL;
+        slot = (slot + 1) & (PROCESS_TABLE_SIZE - 1);
+    }
+    return NULL;  // Table full, the process is just not ranked
+}
+
+// Pull comm, utime+stime and start time out of /proc/<pid>/stat
+static gboolean read_process_stat(const char *pid, char *comm, size_t comm_size,
+                                  unsigned long long *cpu, unsigned long long *start) {
+    char path[64], buf[1024];
+    snprintf(path, sizeof(path), "/proc/%s/stat", pid);
+    
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return FALSE;
+    ssize_t len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len <= 0) return FALSE;
+    buf[len] = '\0';
+    
+    // comm may contain spaces and parentheses, so it runs to the last ')'
+    char *open_paren = strchr(buf, '(');
+    char *close_paren = strrchr(buf, ')');
+    if (!open_paren || !close_paren || close_paren < open_paren) return FALSE;
+    
+    size_t comm_len = MIN((size_t)(close_paren - open_paren - 1), comm_size - 1);
+    memcpy(comm, open_paren + 1, comm_len);
+    comm[comm_len] = '\0';
+    
+    // Fields after comm: state is 3, utime 14, stime 15, starttime 22
+    unsigned long long utime, stime;
+    if (sscanf(close_paren + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu %*d %*d %*d %*d %*d %*d %llu",
+               &utime, &stime, start) != 3) {
+        return FALSE;
+    }
+    *cpu = utime + stime;
+    return TRUE;
+}
+
+// Package energy in microjoules, -1 if RAPL is missing or root-only
+static long long read_rapl_energy(void) {
+    char value[32];
+    long long energy = -1;
+    if (read_sysfs_file("/sys/class/powercap/intel-rapl:0", "energy_uj", value, sizeof(value)) > 0) {
+        parse_sysfs_int(value, &energy);
+    }
+    return energy;
+}
+
+// Forget the samples so a later scan starts from a fresh baseline
+static void reset_process_sampler(void) {
+    if (!process_sampler_primed) return;
+    memset(process_tables, 0, sizeof(process_tables));
+    process_sampler_primed = 0;
+    top_process_count = 0;
+}
+
+static void sample_processes(void) {
+    ProcessSample *previous = process_tables[process_table_current];
+    ProcessSample *next = process_tables[!process_table_current];
+    memset(next, 0, sizeof(process_tables[0]));
+    
+    gint64 now = g_get_monotonic_time();
+    long long energy = read_rapl_energy();
+    
+    DIR *proc = opendir("/proc");
+    if (!proc) return;
+    
+    unsigned long long total_delta = 0;
+    ProcessUsage top[TOP_PROCESS_COUNT];
+    int top_count = 0;
+    struct dirent *entry;
+    
+    while ((entry = readdir(proc))) {
+        if (entry->d_name[0] < '1' || entry->d_name[0] > '9') continue;
+        
+        char comm[16];
+        unsigned long long cpu, start;
+        if (!read_process_stat(entry->d_name, comm, sizeof(comm), &cpu, &start)) continue;
+        
+        int pid = atoi(entry->d_name);
+        ProcessSample *sample = process_lookup(next, pid, TRUE);
+        if (!sample) continue;
+        sample->pid = pid;
+        sample->cpu = cpu;
+        sample->start = start;
+        
+        // A reused PID has a different start time and gets a fresh baseline
+        ProcessSample *before = process_sampler_primed ? process_lookup(previous, pid, FALSE) : NULL;
+        if (!before || before->start != start || cpu < before->cpu) continue;
+        
+        unsigned long long delta = cpu - before->cpu;
+        total_delta += delta;
+        if (delta == 0) continue;
+        
+        // Keep the few largest, insertion sorted
+        int pos = top_count < TOP_PROCESS_COUNT ? top_count++ : TOP_PROCESS_COUNT;
+        while (pos > 0 && top[pos - 1].cpu_delta < delta) {
+            if (pos < TOP_PROCESS_COUNT) top[pos] = top[pos - 1];
+            pos--;
+        }
+        if (pos < TOP_PROCESS_COUNT) {
+            top[pos].pid = pid;
+            top[pos].cpu_delta = delta;
+            snprintf(top[pos].comm, sizeof(top[pos].comm), "%s", comm);
+        }
+    }
+    closedir(proc);
+    
+    if (process_sampler_primed && now > process_sample_time) {
+        double seconds = (now - process_sample_time) / (double)G_USEC_PER_SEC;
+        double ticks_per_second = sysconf(_SC_CLK_TCK);
+        double package_watts = -1;
+        if (energy >= 0 && process_rapl_energy >= 0 && energy >= process_rapl_energy) {
+            package_watts = (energy - process_rapl_energy) / 1e6 / seconds;
+        }
+        
+        for (int i = 0; i < top_count; i++) {
+            top[i].cpu_percent = top[i].cpu_delta / ticks_per_second / seconds * 100.0;
+            // Share of the package power in proportion to CPU time, so an estimate at best
+            top[i].watts = package_watts >= 0 && total_delta > 0 ?
+                package_watts * top[i].cpu_delta / total_delta : -1;
+        }
+        memcpy(top_processes, top, sizeof(top));
+        top_process_count = top_count;
+    }
+    
+    process_table_current = !process_table_current;
+    process_sample_time = now;
+    process_rapl_energy = energy;
+    process_sampler_primed = 1;
+}
+
+// Only pays for /proc scans while they could explain a low battery
+static void update_process_attribution(const BatteryStatus *status) {
+    if (harness_active || !config.process_attribution || !status->present ||
+        status->charging || !battery_is_low(status)) {
+        reset_process_sampler();
+        return;
+    }
+    sample_processes();
+}
+
+// "Top consumers" block for the alert and the status window, empty until two scans exist
+static void format_top_processes(char *buf, size_t size) {
+    buf[0] = '\0';
+    if (top_process_count == 0) return;
+    
+    size_t used = snprintf(buf, size, "Top consumers since the last check:");
+    for (int i = 0; i < top_process_count && used < size; i++) {
+        const ProcessUsage *usage = &top_processes[i];
+        if (usage->watts >= 0) {
+            used += snprintf(buf + used, size - used, "\n  %s (%d): %.0f%% CPU, ~%.1f W",
+                             usage->comm, usage->pid, usage->cpu_percent, usage->watts);
+        } else {
+            used += snprintf(buf + used, size - used, "\n  %s (%d): %.0f%% CPU",
+                             usage->comm, usage->pid, usage->cpu_percent);
+        }
+    }
+}
+
+// Syscall counters for the stdio read path, only used by --bench-sysfs
+static long bench_stdio_opens = 0;
+static long bench_stdio_closes = 0;
+
+// One attribute the way the original code read it: fopen, fscanf, fclose
+static int stdio_read_int(const char *dir, const char *name, long long *value) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *file = fopen(path, "r");
+    bench_stdio_opens++;
+    if (!file) return 0;
+    
+    int ok = fscanf(file, "%lld", value) == 1;
+    fclose(file);
+    bench_stdio_closes++;
+    return ok;
+}
+
+static int stdio_read_string(const char *dir, const char *name, char *buf, int size) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *file = fopen(path, "r");
+    bench_stdio_opens++;
+    if (!file) return 0;
+    
+    int ok = fgets(buf, size, file) != NULL;
+    if (ok) buf[strcspn(buf, "\n")] = 0;
+    fclose(file);
+    bench_stdio_closes++;
+    return ok;
+}
+
+// --bench-sysfs baseline: get_battery_status() with fopen/fscanf/fclose per attribute
+// instead of the persistent descriptors. Same supplies, same attributes, same combining,
+// so the comparison only measures the read path.
+static BatteryStatus get_battery_status_stdio(void) {
+    BatteryStatus status = {0};
+    long long energy_now = 0, energy_full = 0, power_now = 0, capacity_sum = 0;
+    int by_energy = 1, any_charging = 0, any_discharging = 0, units = -1;
+    
+    for (int i = 0; i < battery_count; i++) {
+        BatteryHandle *bat = &battery_handles[i];
+        const char *now_name = bat->reports_charge ? "charge_now" : "energy_now";
+        const char *full_name = bat->reports_charge ? "charge_full" : "energy_full";
+        const char *power_name = bat->reports_charge ? "current_now" : "power_now";
+        long long present = 1, capacity = 0, now, full, power;
+        char state[32];
+        
+        // Only what the pread() path has a descriptor for
+        if (bat->present_fd >= 0 && !stdio_read_int(bat->path, "present", &present)) continue;
+        if (!present) continue;
+        
+        status.present = 1;
+        status.battery_count++;
+        
+        if (bat->capacity_fd >= 0) stdio_read_int(bat->path, "capacity", &capacity);
+        capacity_sum += capacity;
+        
+        if (units >= 0 && units != bat->reports_charge) {
+            by_energy = 0;
+        }
+        units = bat->reports_charge;
+        if (bat->energy_now_fd >= 0 && bat->energy_full_fd >= 0 &&
+            stdio_read_int(bat->path, now_name, &now) && stdio_read_int(bat->path, full_name, &full) && full > 0) {
+            energy_now += now;
+            energy_full += full;
+            if (bat->power_now_fd >= 0 && stdio_read_int(bat->path, power_name, &power)) {
+                power_now += power < 0 ? -power : power;
+            }
+        } else {
+            by_energy = 0;
+        }
+        
+        if (bat->status_fd >= 0 && stdio_read_string(bat->path, "status", state, sizeof(state))) {
+            if (strcmp(state, "Charging") == 0) {
+                any_charging = 1;
+                strcpy(status.status, state);
+            } else if (strcmp(state, "Discharging") == 0) {
+                any_discharging = 1;
+            }
+            if (status.battery_count == 1 && !any_charging) {
+                strcpy(status.status, state);
+            }
+        }
+    }
+    
+    for (int i = 0; i < mains_count; i++) {
+        long long online;
+        if (mains_handles[i].online_fd >= 0 && stdio_read_int(mains_handles[i].path, "online", &online) && online) {
+            status.ac_online = 1;
+        }
+    }
+    
+    if (status.battery_count > 0) {
+        if (by_energy && energy_full > 0) {
+            status.percentage = (int)((energy_now * 100 + energy_full / 2) / energy_full);
+            status.energy_now = energy_now;
+            status.energy_full = energy_full;
+            status.power_now = power_now;
+        } else {
+            status.percentage = (int)(capacity_sum / status.battery_count);
+        }
+        if (status.percentage > 100) status.percentage = 100;
+    }
+    status.charging = any_charging || (status.ac_online && !any_discharging);
+    
+    return status;
+}
+
+// Compare the persistent pread() path against the stdio path on this machine
+static int run_sysfs_benchmark(int samples) {
+    struct timespec start, end;
+    
+    printf("🧪 Benchmarking %d battery samples per read path...\n", samples);
+    
+    open_battery_handles();
+    if (!get_battery_status().present) {
+        printf("❌ No battery detected, nothing to benchmark\n");
+        return 1;
+    }
+    
+    // Baseline: fopen/fscanf/fclose per attribute, per sample
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < samples; i++) {
+        get_battery_status_stdio();
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double stdio_ns = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / samples;
+    
+    // Persistent descriptors: one pread() per attribute, per sample
+    guint64 preads_start = monitor_stats.sysfs_reads;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < samples; i++) {
+        get_battery_status();
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double pread_ns = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / samples;
+    
+    // Every file stdio managed to open was also read and closed
+    double stdio_syscalls = (double)(bench_stdio_opens + bench_stdio_closes * 2) / samples;
+    double pread_syscalls = (double)(monitor_stats.sysfs_reads - preads_start) / samples;
+    
+    printf("   stdio (fopen/fscanf/fclose): %10.0f ns/sample, >= %.1f syscalls/sample\n",
+           stdio_ns, stdio_syscalls);
+    printf("   persistent fd + pread():     %10.0f ns/sample,    %.1f syscalls/sample\n",
+           pread_ns, pread_syscalls);
+    printf("   Speedup: %.2fx\n", pread_ns > 0 ? stdio_ns / pread_ns : 0.0);
+    
+    close_battery_handles();
+    return 0;
+}
+
+// Clock for everything that measures battery drain; the replay harness substitutes trace time
+static gint64 monitor_clock(void) {
+    return harness_active ? harness_clock : g_get_monotonic_time();
+}
+
+// Read and write syscall counts the kernel keeps for this process
+static void read_proc_io(long long *syscr, long long *syscw) {
+    char buf[512];
+    *syscr = *syscw = 0;
+    
+    // Raw open/read so the measurement itself doesn't allocate
+    int fd = open("/proc/self/io", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    ssize_t len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len <= 0) return;
+    buf[len] = '\0';
+    
+    char *field = strstr(buf, "syscr:");
+    if (field) *syscr = atoll(field + 6);
+    field = strstr(buf, "syscw:");
+    if (field) *syscw = atoll(field + 6);
+}
+
+// Load a history file as an oldest-first array of samples
+static HistoryRecord *load_replay_trace(const char *path, guint64 *count) {
+    gchar *contents = NULL;
+    gsize length = 0;
+    GError *error = NULL;
+    
+    if (!g_file_get_contents(path, &contents, &length, &error)) {
+        printf("❌ Failed to read trace %s: %s\n", path, error->message);
+        g_error_free(error);
+        return NULL;
+    }
+    
+    const HistoryHeader *header = (const HistoryHeader *)contents;
+    if (length < sizeof(HistoryHeader) || header->magic != HISTORY_MAGIC ||
+        header->version != HISTORY_VERSION || header->record_size != sizeof(HistoryRecord) ||
+        length < sizeof(HistoryHeader) + (gsize)header->capacity * sizeof(HistoryRecord)) {
+        printf("❌ %s is not a battery history file\n", path);
+        g_free(contents);
+        return NULL;
+    }
+    
+    const HistoryRecord *ring = (const HistoryRecord *)(contents + sizeof(HistoryHeader));
+    guint64 held = header->head < header->capacity ? header->head : header->capacity;
+    guint64 first = header->head - held;
+    
+    HistoryRecord *records = g_new(HistoryRecord, held ? held : 1);
+    for (guint64 i = 0; i < held; i++) {
+        records[i] = ring[(first + i) % header->capacity];
+    }
+    
+    g_free(contents);
+    *count = held;
+    return records;
+}
+
+// Rebuild the status a check would have read when the sample was recorded
+static BatteryStatus status_from_record(const HistoryRecord *record) {
+    static const char *state_names[] = { "Discharging", "Charging", "Full", "Not charging", "Unknown" };
+    BatteryStatus status = {0};
+    
+    status.present = 1;
+    status.battery_count = 1;
+    status.percentage = record->capacity;
+    status.ac_online = record->ac_online;
+    status.energy_now = record->energy;
+    status.power_now = record->power;
+    
+    // History doesn't keep energy_full; the capacity ratio recovers it closely enough
+    if (record->capacity > 0) {
+        status.energy_full = (long long)record->energy * 100 / record->capacity;
+    }
+    
+    int state = record->state <= HISTORY_UNKNOWN ? record->state : HISTORY_UNKNOWN;
+    snprintf(status.status, sizeof(status.status), "%s", state_names[state]);
+    status.charging = state == HISTORY_CHARGING || (record->ac_online && state != HISTORY_DISCHARGING);
+    return status;
+}
+
+// Overwrite one fake sysfs attribute in place, so the monitor's open descriptors see it
+static void write_fake_attr(const char *dir, const char *name, const char *value) {
+    char path[600];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return;
+    if (write(fd, value, strlen(value)) < 0) {
+        printf("❌ Failed to write %s: %s\n", path, strerror(errno));
+    }
+    close(fd);
+}
+
+// Lay a one battery, one adapter tree under the sysfs root
+static void create_fake_sysfs_tree(void) {
+    char bat[300], ac[300];
+    snprintf(bat, sizeof(bat), "%s/BAT0", sysfs_root);
+    snprintf(ac, sizeof(ac), "%s/AC", sysfs_root);
+    g_mkdir_with_parents(bat, 0755);
+    g_mkdir_with_parents(ac, 0755);
+    
+    write_fake_attr(bat, "type", "Battery\n");
+    write_fake_attr(bat, "present", "1\n");
+    write_fake_attr(ac, "type", "Mains\n");
+    battery_handles_stale = 1;
+}
+
+static void write_fake_sample(const BatteryStatus *status) {
+    char bat[300], ac[300], value[64];
+    snprintf(bat, sizeof(bat), "%s/BAT0", sysfs_root);
+    snprintf(ac, sizeof(ac), "%s/AC", sysfs_root);
+    
+    snprintf(value, sizeof(value), "%d\n", status->percentage);
+    write_fake_attr(bat, "capacity", value);
+    snprintf(value, sizeof(value), "%s\n", status->status);
+    write_fake_attr(bat, "status", value);
+    snprintf(value, sizeof(value), "%lld\n", status->energy_now);
+    write_fake_attr(bat, "energy_now", value);
+    snprintf(value, sizeof(value), "%lld\n", status->energy_full);
+    write_fake_attr(bat, "energy_full", value);
+    snprintf(value, sizeof(value), "%lld\n", status->power_now);
+    write_fake_attr(bat, "power_now", value);
+    snprintf(value, sizeof(value), "%d\n", status->ac_online);
+    write_fake_attr(ac, "online", value);
+}
+
+// Forget everything learned from the previous run so each mode starts cold
+static void reset_monitor_state(void) {
+    cancel_critical_grace();
+    last_percentage = -1;
+    last_charging_state = -1;
+    alert_state = ALERT_UNKNOWN;
+    alert_pending_since = 0;
+    alert_last_time = 0;
+    alert_active = 0;
+    memset(&last_status, 0, sizeof(last_status));
+    discharge_rate = 0.0;
+    rate_sample_time = 0;
+    rate_sample_percentage = -1;
+    smoothed_power = 0.0;
+    smoothed_power_time = 0;
+    smoothed_power_charging = -1;
+    harness_next_check = 0;
+    harness_warning_sample = -1;
+    harness_critical_sample = -1;
+    harness_suspend_sample = -1;
+}
+
+static int compare_gint64(const void *a, const void *b) {
+    gint64 x = *(const gint64 *)a, y = *(const gint64 *)b;
+    return (x > y) - (x < y);
+}
+
+static void format_sample_index(gint64 sample, char *buf, size_t size) {
+    if (sample < 0) {
+        snprintf(buf, size, "never");
+    } else {
+        snprintf(buf, size, "%" G_GINT64_FORMAT, sample);
+    }
+}
+
+// Drive check_battery_timer through a trace on its virtual clock, the way one scheduling mode would
+static int replay_trace_in_mode(const HarnessMode *mode, const HistoryRecord *records, guint64 count,
+                       const HarnessOptions *options) {
+    gint64 *latencies = g_new(gint64, count ? count : 1);
+    guint64 checks = 0, heap_changes = 0;
+    long long syscr_total = 0, syscw_total = 0, syscr_start, syscw_start, syscr_end, syscw_end;
+    
+    config.event_driven = mode->event_driven;
+    config.adaptive_interval = mode->adaptive_interval;
+    reset_monitor_state();
+    
+    // Cost of one /proc/self/io pair, taken off every measured check
+    read_proc_io(&syscr_start, &syscw_start);
+    read_proc_io(&syscr_end, &syscw_end);
+    long long syscr_overhead = syscr_end - syscr_start;
+    long long syscw_overhead = syscw_end - syscw_start;
+    
+    guint64 preads_start = monitor_stats.sysfs_reads;
+    struct mallinfo2 heap_start = mallinfo2();
+    
+    for (guint64 i = 0; i < count; i++) {
+        const HistoryRecord *record = &records[i];
+        BatteryStatus status = status_from_record(record);
+        
+        harness_clock = record->timestamp;
+        harness_sample = i;
+        if (sysfs_root_override) {
+            write_fake_sample(&status);
+        } else {
+            harness_status = &status;
+        }
+        
+        // The countdown is a real timer in normal runs; here it expires on trace time
+        if (critical_grace_id &&
+            harness_clock - critical_grace_started >= (gint64)CRITICAL_GRACE_SECONDS * G_USEC_PER_SEC) {
+            g_source_remove(critical_grace_id);
+            critical_grace_expired(NULL);
+        }
+        
+        // Event mode also wakes on whatever the kernel would have sent a uevent for
+        gboolean due = harness_clock >= harness_next_check;
+        if (mode->event_driven && i > 0 &&
+            (record->capacity != records[i - 1].capacity || record->state != records[i - 1].state ||
+             record->ac_online != records[i - 1].ac_online)) {
+            due = TRUE;
+        }
+        
+        if (due) {
+            struct timespec start, end;
+            size_t heap_before = mallinfo2().uordblks;
+            read_proc_io(&syscr_start, &syscw_start);
+            
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            check_battery_timer(NULL);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            
+            read_proc_io(&syscr_end, &syscw_end);
+            if (mallinfo2().uordblks != heap_before) heap_changes++;
+            syscr_total += syscr_end - syscr_start - syscr_overhead;
+            syscw_total += syscw_end - syscw_start - syscw_overhead;
+            latencies[checks++] = (end.tv_sec - start.tv_sec) * 1000000000LL + (end.tv_nsec - start.tv_nsec);
+        }
+        
+        // Pace the trace, but don't sit through long gaps such as a suspended laptop
+        if (options->speed > 0 && i + 1 < count) {
+            gint64 wait = (records[i + 1].timestamp - record->timestamp) / options->speed;
+            if (wait > G_USEC_PER_SEC) wait = G_USEC_PER_SEC;
+            if (wait > 0) g_usleep(wait);
+        }
+    }
+    
+    harness_status = NULL;
+    struct mallinfo2 heap_end = mallinfo2();
+    
+    char warning[32], critical[32], suspend[32];
+    format_sample_index(harness_warning_sample, warning, sizeof(warning));
+    format_sample_index(harness_critical_sample, critical, sizeof(critical));
+    format_sample_index(harness_suspend_sample, suspend, sizeof(suspend));
+    
+    printf("🧪 %s mode: %" G_GUINT64_FORMAT " checks over %" G_GUINT64_FORMAT " samples\n",
+           mode->name, checks, count);
+    if (checks > 0) {
+        qsort(latencies, checks, sizeof(gint64), compare_gint64);
+        printf("   check latency: p50 %.1f us, p90 %.1f us, p99 %.1f us, max %.1f us\n",
+               latencies[checks / 2] / 1000.0, latencies[checks * 9 / 10] / 1000.0,
+               latencies[checks * 99 / 100] / 1000.0, latencies[checks - 1] / 1000.0);
+        printf("   per check: %.1f sysfs preads, %.1f read / %.1f write syscalls (/proc/self/io)\n",
+               (double)(monitor_stats.sysfs_reads - preads_start) / checks,
+               (double)syscr_total / checks, (double)syscw_total / checks);
+        printf("   heap: %+lld bytes in use over the run, in-use size changed on %" G_GUINT64_FORMAT
+               " checks (mallinfo2, net of frees)\n",
+               (long long)heap_end.uordblks - (long long)heap_start.uordblks, heap_changes);
+    }
+    printf("   first warning at sample %s, first critical at %s, suspend decided at %s\n",
+           warning, critical, suspend);
+    
+    int failures = 0;
+    if (options->expect_warning >= 0 && harness_warning_sample != options->expect_warning) {
+        printf("   ❌ Expected the first warning at sample %d\n", options->expect_warning);
+        failures++;
+    }
+    if (options->expect_suspend >= 0 && harness_suspend_sample != options->expect_suspend) {
+        printf("   ❌ Expected the suspend decision at sample %d\n", options->expect_suspend);
+        failures++;
+    }
+    
+    g_free(latencies);
+    return failures;
+}
+
+// --replay: run a recorded trace through each scheduling mode and compare them
+static int run_replay_harness(const char *trace_path, const HarnessOptions *options) {
+    static const HarnessMode modes[] = {
+        { "polling", 0, 0 },
+        { "event", 1, 0 },
+        { "adaptive", 0, 1 },
+    };
+    
+    guint64 count = 0;
+    HistoryRecord *records = load_replay_trace(trace_path, &count);
+    if (!records) return 1;
+    if (count == 0) {
+        printf("❌ Trace %s holds no samples\n", trace_path);
+        g_free(records);
+        return 1;
+    }
+    
+    printf("🧪 Replaying %" G_GUINT64_FORMAT " samples from %s at %dx%s\n", count, trace_path,
+           options->speed, options->speed > 0 ? "" : " (unpaced)");
+    if (sysfs_root_override) {
+        printf("   Samples are written to %s and read back through sysfs\n", sysfs_root);
+        create_fake_sysfs_tree();
+    }
+    
+    // Suspends and alerts are recorded rather than carried out
+    harness_active = 1;
+    headless_mode = 1;
+    
+    int failures = 0, ran = 0;
+    for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+        if (options->mode && strcmp(options->mode, modes[i].name) != 0) continue;
+        failures += replay_trace_in_mode(&modes[i], records, count, options);
+        ran++;
+    }
+    
+    harness_active = 0;
+    close_battery_handles();
+    g_free(records);
+    
+    if (!ran) {
+        printf("❌ Unknown mode %s (polling, event or adaptive)\n", options->mode);
+        return 1;
+    }
+    return failures ? 1 : 0;
+}
+
+// Map the history file, creating or resetting it when the layout doesn't match
+static void open_history(void) {
+    char dir[512], path[600];
+    const char *state_home = getenv("XDG_STATE_HOME");
+    const char *home = getenv("HOME");
+    
+    if (state_home && state_home[0]) {
+        snprintf(dir, sizeof(dir), "%s/cool-little-battery-monitor", state_home);
+    } else if (home) {
+        snprintf(dir, sizeof(dir), "%s/.local/state/cool-little-battery-monitor", home);
+    } else {
+        return;
+    }
+    snprintf(path, sizeof(path), "%s/history.bin", dir);
+    
+    if (g_mkdir_with_parents(dir, 0700) < 0) {
+        log_error(NULL, "❌ Failed to create %s: %s", dir, strerror(errno));
+        return;
+    }
+    
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        log_error(NULL, "❌ Failed to open history %s: %s", path, strerror(errno));
+        return;
+    }
+    
+    size_t size = sizeof(HistoryHeader) + HISTORY_CAPACITY * sizeof(HistoryRecord);
+    struct stat st;
+    if (fstat(fd, &st) < 0 || ((size_t)st.st_size != size && ftruncate(fd, size) < 0)) {
+        log_error(NULL, "❌ Failed to size history %s: %s", path, strerror(errno));
+        close(fd);
+        return;
+    }
+    
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        log_error(NULL, "❌ Failed to map history %s: %s", path, strerror(errno));
+        return;
+    }
+    
+    history_header = map;
+    history_records = (HistoryRecord *)((char *)map + sizeof(HistoryHeader));
+    history_map_size = size;
+    
+    if (history_header->magic != HISTORY_MAGIC ||
+        history_header->version != HISTORY_VERSION ||
+        history_header->record_size != sizeof(HistoryRecord) ||
+        history_header->capacity != HISTORY_CAPACITY) {
+        memset(map, 0, size);
+        history_header->magic = HISTORY_MAGIC;
+        history_header->version = HISTORY_VERSION;
+        history_header->record_size = sizeof(HistoryRecord);
+        history_header->capacity = HISTORY_CAPACITY;
+    }
+}
+
+static void close_history(void) {
+    if (history_header) {
+        munmap(history_header, history_map_size);
+        history_header = NULL;
+        history_records = NULL;
+    }
+}
+
+static HistoryState history_state_from_status(const BatteryStatus *status) {
+    if (strcmp(status->status, "Discharging") == 0) return HISTORY_DISCHARGING;
+    if (strcmp(status->status, "Charging") == 0) return HISTORY_CHARGING;
+    if (strcmp(status->status, "Full") == 0) return HISTORY_FULL;
+    if (strcmp(status->status, "Not charging") == 0) return HISTORY_NOT_CHARGING;
+    return HISTORY_UNKNOWN;
+}
+
+// Append one sample: no allocation and no write(), the kernel flushes the dirty page
+static void history_append(const BatteryStatus *status) {
+    if (!history_header || !status->present) return;
+    
+    guint64 head = history_header->head;
+    HistoryRecord *record = &history_records[head % HISTORY_CAPACITY];
+    record->timestamp = g_get_real_time();
+    record->capacity = status->percentage;
+    record->energy = (gint32)status->energy_now;
+    record->power = (gint32)status->power_now;
+    record->time_remaining = status->time_remaining;
+    record->state = history_state_from_status(status);
+    record->ac_online = status->ac_online;
+    
+    // Publish the record only once it's complete, so a crash mid-store never exposes it
+    __atomic_store_n(&history_header->head, head + 1, __ATOMIC_RELEASE);
+}
+
+// Total samples ever written; the newest sits at history_head() - 1
+static guint64 history_head(void) {
+    if (!history_header) return 0;
+    return __atomic_load_n(&history_header->head, __ATOMIC_ACQUIRE);
+}
+
+// Number of samples currently held in the ring
+static guint64 history_count(void) {
+    if (!history_header) return 0;
+    guint64 head = __atomic_load_n(&history_header->head, __ATOMIC_ACQUIRE);
+    return head < HISTORY_CAPACITY ? head : HISTORY_CAPACITY;
+}
+
+// Sample by age, 0 being the oldest still held
+static const HistoryRecord *history_get(guint64 index) {
+    guint64 head = __atomic_load_n(&history_header->head, __ATOMIC_ACQUIRE);
+    guint64 first = head < HISTORY_CAPACITY ? 0 : head - HISTORY_CAPACITY;
+    return &history_records[(first + index) % HISTORY_CAPACITY];
+}
+
+// Status segment: the latest published state in POSIX shared memory, so status bars
+// and scripts read it with plain loads instead of polling sysfs themselves. The
+// sequence is odd while a write is in progress; readers retry until it is even and
+// unchanged across their copy.
+static void status_segment_name(char *buf, size_t size) {
+    snprintf(buf, size, "/cool-little-battery-monitor-%u", (unsigned)getuid());
+}
+
+static void open_status_segment(void) {
+    char name[64];
+    status_segment_name(name, sizeof(name));
+    
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        log_error(NULL, "❌ Failed to create status segment %s: %s", name, strerror(errno));
+        return;
+    }
+    
+    // The lock is held for as long as we publish. A segment left by a crashed monitor
+    // has no holder and is taken over; a live one is left alone.
+    if (flock(fd, LOCK_EX | LOCK_NB) < 0) {
+        if (errno == EWOULDBLOCK) {
+            log_warning(NULL, "❌ Another monitor is publishing %s, status is not published", name);
+        } else {
+            log_error(NULL, "❌ Failed to lock status segment %s: %s", name, strerror(errno));
+        }
+        close(fd);
+        return;
+    }
+    
+    void *map = MAP_FAILED;
+    if (ftruncate(fd, sizeof(StatusSegment)) == 0) {
+        map = mmap(NULL, sizeof(StatusSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (map == MAP_FAILED) {
+        log_error(NULL, "❌ Failed to map status segment %s: %s", name, strerror(errno));
+        close(fd);
+        return;
+    }
+    
+    status_segment = map;
+    status_segment_fd = fd;
+    memset(status_segment, 0, sizeof(StatusSegment));
+    status_segment->magic = STATUS_SEGMENT_MAGIC;
+    status_segment->version = STATUS_SEGMENT_VERSION;
+    status_segment->size = sizeof(StatusSegment);
+}
+
+// Unlinked on exit so readers can tell the monitor isn't running
+static void close_status_segment(void) {
+    if (!status_segment) return;
+    
+    char name[64];
+    status_segment_name(name, sizeof(name));
+    munmap(status_segment, sizeof(StatusSegment));
+    shm_unlink(name);
+    close(status_segment_fd);  // Drops the lock, after the name is gone
+    status_segment = NULL;
+    status_segment_fd = -1;
+}
+
+// Publish a sample; nothing is written, and nobody is signalled, unless it differs
+static void publish_status(const BatteryStatus *status) {
+    if (!status_segment || harness_active) return;
+    
+    StatusSnapshot snapshot;
+    memset(&snapshot, 0, sizeof(snapshot));  // Padding too, it takes part in the comparison
+    snapshot.present = status->present;
+    snapshot.percentage = status->percentage;
+    snapshot.charging = status->charging;
+    snapshot.ac_online = status->ac_online;
+    snapshot.battery_count = status->battery_count;
+    snapshot.time_remaining = status->time_remaining;
+    snapshot.shutdown_seconds = status->shutdown_seconds;
+    // The debounced state, so readers don't see a battery flapping at a threshold
+    snapshot.low = status->present && (alert_state == ALERT_LOW || alert_state == ALERT_CRITICAL);
+    snapshot.critical = status->present && alert_state == ALERT_CRITICAL;
+    snapshot.warning_level = config.warning_level;
+    snapshot.critical_level = config.critical_level;
+    snapshot.energy_now = status->energy_now;
+    snapshot.energy_full = status->energy_full;
+    snapshot.power_now = status->power_now;
+    snapshot.smoothed_power = (gint64)smoothed_power;
+    snprintf(snapshot.status, sizeof(snapshot.status), "%s", status->status);
+    
+    if (memcmp(&snapshot, &status_segment->snapshot, sizeof(snapshot)) == 0) return;
+    
+    guint32 sequence = status_segment->sequence;
+    __atomic_store_n(&status_segment->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    status_segment->snapshot = snapshot;
+    status_segment->changed = g_get_real_time();
+    __atomic_store_n(&status_segment->sequence, sequence + 2, __ATOMIC_RELEASE);
+    
+    if (dbus_connection) {
+        g_dbus_connection_emit_signal(dbus_connection, NULL, DBUS_OBJECT_PATH, "org.coollittlebattery.Status",
+                                      "StatusChanged", g_variant_new("(u)", sequence + 2), NULL);
+    }
+}
+
+// --status: print the running monitor's latest state as "name value" lines.
+// A consistent copy takes no syscalls once the segment is mapped.
+static int run_status_client(void) {
+    char name[64];
+    status_segment_name(name, sizeof(name));
+    
+    int fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0) {
+        fprintf(stderr, "Battery monitor not running: %s\n", strerror(errno));
+        return 1;
+    }
+    const StatusSegment *segment = mmap(NULL, sizeof(StatusSegment), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (segment == MAP_FAILED) {
+        fprintf(stderr, "Failed to map %s: %s\n", name, strerror(errno));
+        return 1;
+    }
+    if (segment->magic != STATUS_SEGMENT_MAGIC || segment->version != STATUS_SEGMENT_VERSION) {
+        fprintf(stderr, "Status segment %s has an unknown layout\n", name);
+        munmap((void *)segment, sizeof(StatusSegment));
+        return 1;
+    }
+    
+    StatusSnapshot snapshot;
+    gint64 changed;
+    guint32 before, after;
+    do {
+        before = __atomic_load_n(&segment->sequence, __ATOMIC_ACQUIRE);
+        snapshot = segment->snapshot;
+        changed = segment->changed;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        after = __atomic_load_n(&segment->sequence, __ATOMIC_RELAXED);
+    } while ((before & 1) || before != after);
+    munmap((void *)segment, sizeof(StatusSegment));
+    
+    snapshot.status[sizeof(snapshot.status) - 1] = '\0';
+    printf("sequence %u\n", after);
+    printf("changed %" G_GINT64_FORMAT "\n", changed);
+    printf("present %d\n", snapshot.present);
+    printf("percentage %d\n", snapshot.percentage);
+    printf("status %s\n", snapshot.status);
+    printf("charging %d\n", snapshot.charging);
+    printf("ac_online %d\n", snapshot.ac_online);
+    printf("battery_count %d\n", snapshot.battery_count);
+    printf("time_remaining %d\n", snapshot.time_remaining);
+    printf("shutdown_seconds %d\n", snapshot.shutdown_seconds);
+    printf("low %d\n", snapshot.low);
+    printf("critical %d\n", snapshot.critical);
+    printf("warning_level %d\n", snapshot.warning_level);
+    printf("critical_level %d\n", snapshot.critical_level);
+    printf("energy_now %" G_GINT64_FORMAT "\n", snapshot.energy_now);
+    printf("energy_full %" G_GINT64_FORMAT "\n", snapshot.energy_full);
+    printf("power_now %" G_GINT64_FORMAT "\n", snapshot.power_now);
+    printf("smoothed_power %" G_GINT64_FORMAT "\n", snapshot.smoothed_power);
+    return 0;
+}
+
+// Fleet telemetry: upload the history not yet exported as one gzip-compressed batch in
+// line protocol, plus a wear line per battery. Everything past the record copy runs on
+// a worker thread, so a slow network never holds up a check.
+typedef struct {
+    HistoryRecord *records;
+    guint64 count;
+    guint64 end;                // History head the batch runs up to
+    char paths[MAX_BATTERIES][256];
+    int battery_count;
+    char url[512];
+} TelemetryBatch;
+
+static void free_telemetry_batch(gpointer data) {
+    TelemetryBatch *batch = data;
+    g_free(batch->records);
+    g_free(batch);
+}
+
+// Line protocol body: one "battery" line per sample, one "battery_wear" line per battery
+static GString *build_telemetry_body(const TelemetryBatch *batch) {
+    const char *host = g_get_host_name();
+    GString *body = g_string_sized_new(batch->count * 96 + 256);
+    
+    for (guint64 i = 0; i < batch->count; i++) {
+        const HistoryRecord *record = &batch->records[i];
+        g_string_append_printf(body,
+                               "battery,host=%s capacity=%di,energy=%di,power=%di,minutes=%di,state=%ui,ac=%ui %"
+                               G_GINT64_FORMAT "000\n",
+                               host, record->capacity, record->energy, record->power, record->time_remaining,
+                               record->state, record->ac_online, record->timestamp);
+    }
+    
+    gint64 now = g_get_real_time();
+    for (int i = 0; i < batch->battery_count; i++) {
+        const char *path = batch->paths[i];
+        long long cycles = -1, full = -1, design = -1;
+        
+        // Wear moves slowly, so it's read per upload rather than kept open per sample
+        char value[64];
+        if (read_sysfs_file(path, "cycle_count", value, sizeof(value)) > 0) parse_sysfs_int(value, &cycles);
+        if (read_sysfs_file(path, "energy_full", value, sizeof(value)) > 0 ||
+            read_sysfs_file(path, "charge_full", value, sizeof(value)) > 0) parse_sysfs_int(value, &full);
+        if (read_sysfs_file(path, "energy_full_design", value, sizeof(value)) > 0 ||
+            read_sysfs_file(path, "charge_full_design", value, sizeof(value)) > 0) parse_sysfs_int(value, &design);
+        
+        g_string_append_printf(body,
+                               "battery_wear,host=%s,battery=%s cycle_count=%lldi,energy_full=%lldi,"
+                               "energy_full_design=%lldi %" G_GINT64_FORMAT "000\n",
+                               host, strrchr(path, '/') + 1, cycles, full, design, now);
+    }
+    
+    return body;
+}
+
+static GBytes *gzip_bytes(const char *data, gsize length, GError **error) {
+    GZlibCompressor *compressor = g_zlib_compressor_new(G_ZLIB_COMPRESSOR_FORMAT_GZIP, -1);
+    GByteArray *out = g_byte_array_sized_new(length / 4 + 64);
+    gsize offset = 0;
+    guint8 chunk[16384];
+    
+    for (;;) {
+        gsize bytes_read = 0, bytes_written = 0;
+        GConverterResult result = g_converter_convert(G_CONVERTER(compressor), data + offset, length - offset,
+                                                      chunk, sizeof(chunk), G_CONVERTER_INPUT_AT_END,
+                                                      &bytes_read, &bytes_written, error);
+        if (result == G_CONVERTER_ERROR) {
+            g_object_unref(compressor);
+            g_byte_array_unref(out);
+            return NULL;
+        }
+        offset += bytes_read;
+        g_byte_array_append(out, chunk, bytes_written);
+        if (result == G_CONVERTER_FINISHED) break;
+    }
+    
+    g_object_unref(compressor);
+    return g_byte_array_free_to_bytes(out);
+}
+
+// Minimal HTTP/1.1 POST over GSocketClient; TLS when the URL is https
+static gboolean http_post(const char *url, GBytes *body, GError **error) {
+    GUri *uri = g_uri_parse(url, G_URI_FLAGS_NONE, error);
+    if (!uri) return FALSE;
+    
+    gboolean tls = g_strcmp0(g_uri_get_scheme(uri), "https") == 0;
+    int port = g_uri_get_port(uri) > 0 ? g_uri_get_port(uri) : (tls ? 443 : 80);
+    const char *path = g_uri_get_path(uri)[0] ? g_uri_get_path(uri) : "/";
+    const char *query = g_uri_get_query(uri);
+    
+    GSocketClient *client = g_socket_client_new();
+    g_socket_client_set_tls(client, tls);
+    g_socket_client_set_timeout(client, 30);
+    
+    GSocketConnection *connection = g_socket_client_connect_to_host(client, g_uri_get_host(uri), port, NULL, error);
+    g_object_unref(client);
+    if (!connection) {
+        g_uri_unref(uri);
+        return FALSE;
+    }
+    
+    gsize length;
+    const char *data = g_bytes_get_data(body, &length);
+    char *request = g_strdup_printf("POST %s%s%s HTTP/1.1\r\n"
+                                    "Host: %s\r\n"
+                                    "User-Agent: cool-little-battery-monitor\r\n"
+                                    "Content-Type: text/plain; charset=utf-8\r\n"
+                                    "Content-Encoding: gzip\r\n"
+                                    "Content-Length: %" G_GSIZE_FORMAT "\r\n"
+                                    "Connection: close\r\n\r\n",
+                                    path, query ? "?" : "", query ? query : "",
+                                    g_uri_get_host(uri), length);
+    g_uri_unref(uri);
+    
+    GOutputStream *out = g_io_stream_get_output_stream(G_IO_STREAM(connection));
+    gboolean ok = g_output_stream_write_all(out, request, strlen(request), NULL, NULL, error) &&
+                  g_output_stream_write_all(out, data, length, NULL, NULL, error);
+    g_free(request);
+    
+    if (ok) {
+        // Only the status line matters, however many reads it arrives in
+        GDataInputStream *in = g_data_input_stream_new(g_io_stream_get_input_stream(G_IO_STREAM(connection)));
+        g_filter_input_stream_set_close_base_stream(G_FILTER_INPUT_STREAM(in), FALSE);  // The connection closes it
+        GError *read_error = NULL;
+        char *status_line = g_data_input_stream_read_line(in, NULL, NULL, &read_error);
+        g_object_unref(in);
+        
+        int code = 0;
+        if (status_line) {
+            sscanf(status_line, "HTTP/%*s %d", &code);
+            g_free(status_line);
+        }
+        if (read_error) {
+            g_propagate_error(error, read_error);
+        } else if (code < 200 || code > 299) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED, "server replied with status %d", code);
+        }
+        ok = code >= 200 && code <= 299;
+    }
+    
+    g_io_stream_close(G_IO_STREAM(connection), NULL, NULL);
+    g_object_unref(connection);
+    return ok;
+}
+
+static void telemetry_upload_thread(GTask *task, gpointer source, gpointer task_data, GCancellable *cancellable) {
+    TelemetryBatch *batch = task_data;
+    GError *error = NULL;
+    
+    GString *body = build_telemetry_body(batch);
+    GBytes *compressed = gzip_bytes(body->str, body->len, &error);
+    g_string_free(body, TRUE);
+    
+    if (compressed && http_post(batch->url, compressed, &error)) {
+        g_task_return_boolean(task, TRUE);
+    } else {
+        g_task_return_error(task, error);
+    }
+    if (compressed) g_bytes_unref(compressed);
+}
+
+static void on_telemetry_uploaded(GObject *source, GAsyncResult *res, gpointer data) {
+    TelemetryBatch *batch = g_task_get_task_data(G_TASK(res));
+    GError *error = NULL;
+    
+    if (g_task_propagate_boolean(G_TASK(res), &error)) {
+        // Stored in the history header, so a restart doesn't resend the batch
+        if (history_header) history_header->exported = batch->end;
+    } else {
+        log_warning("telemetry", "❌ Telemetry upload failed, will retry with the next batch: %s", error->message);
+        g_error_free(error);
+    }
+    
+    telemetry_in_flight = 0;
+}
+
+// Called every check: upload when the interval has passed or the charger was just plugged in
+static void maybe_export_telemetry(const BatteryStatus *status) {
+    if (!config.telemetry_url[0] || !history_header || telemetry_in_flight || harness_active) return;
+    
+    gint64 now = g_get_monotonic_time();
+    gboolean plugged_in = last_charging_state == 0 && status->charging;
+    gboolean due = now - telemetry_last_attempt >= (gint64)config.telemetry_interval * 60 * G_USEC_PER_SEC;
+    if (!plugged_in && !due) return;
+    
+    guint64 head = history_head();
+    guint64 first = head - history_count();
+    guint64 start = history_header->exported > first ? history_header->exported : first;
+    if (start >= head) return;
+    
+    // Copy the pending records now; the ring keeps moving while the worker runs
+    TelemetryBatch *batch = g_new0(TelemetryBatch, 1);
+    batch->count = head - start;
+    batch->end = head;
+    batch->records = g_new(HistoryRecord, batch->count);
+    for (guint64 i = 0; i < batch->count; i++) {
+        batch->records[i] = *history_get(start - first + i);
+    }
+    for (int i = 0; i < battery_count; i++) {
+        snprintf(batch->paths[i], sizeof(batch->paths[i]), "%s", battery_handles[i].path);
+    }
+    batch->battery_count = battery_count;
+    snprintf(batch->url, sizeof(batch->url), "%s", config.telemetry_url);
+    
+    telemetry_in_flight = 1;
+    telemetry_last_attempt = now;
+    
+    GTask *task = g_task_new(NULL, NULL, on_telemetry_uploaded, NULL);
+    g_task_set_task_data(task, batch, free_telemetry_batch);
+    g_task_run_in_thread(task, telemetry_upload_thread);
+    g_object_unref(task);
+}
+
+// Drop the resolved pixbufs, e.g. after the panel or the icon theme changed
+static void clear_tray_icon_cache(void) {
+    for (int i = 0; i < TRAY_ICON_CACHE_SIZE; i++) {
+        if (tray_icon_cache[i].pixbuf) {
+            g_object_unref(tray_icon_cache[i].pixbuf);
+            tray_icon_cache[i].pixbuf = NULL;
+        }
+        tray_icon_cache[i].name[0] = '\0';
+    }
+    tray_shown_icon[0] = '\0';
+}
+
+// Resolve an icon at the tray's size once, then serve it from the cache
+static GdkPixbuf *lookup_tray_pixbuf(const char *name) {
+    gint size = gtk_status_icon_get_size(tray_icon);
+    if (size <= 0) return NULL;  // Not embedded yet, let GTK size it
+    
+    for (int i = 0; i < TRAY_ICON_CACHE_SIZE; i++) {
+        if (tray_icon_cache[i].pixbuf && tray_icon_cache[i].size == size &&
+            strcmp(tray_icon_cache[i].name, name) == 0) {
+            return tray_icon_cache[i].pixbuf;
+        }
+    }
+    
+    GError *error = NULL;
+    GdkPixbuf *pixbuf = gtk_icon_theme_load_icon(gtk_icon_theme_get_default(), name, size,
+                                                 GTK_ICON_LOOKUP_FORCE_SIZE, &error);
+    if (!pixbuf) {
+        g_error_free(error);
+        return NULL;
+    }
+    
+    TrayIconCacheEntry *slot = &tray_icon_cache[tray_icon_cache_next];
+    tray_icon_cache_next = (tray_icon_cache_next + 1) % TRAY_ICON_CACHE_SIZE;
+    if (slot->pixbuf) {
+        g_object_unref(slot->pixbuf);
+    }
+    snprintf(slot->name, sizeof(slot->name), "%s", name);
+    slot->size = size;
+    slot->pixbuf = pixbuf;
+    return pixbuf;
+}
+
+// Only talk to the panel when the visible icon actually changes
+static void set_tray_icon(const char *name) {
+    if (strcmp(name, tray_shown_icon) == 0) return;
+    
+    GdkPixbuf *pixbuf = lookup_tray_pixbuf(name);
+    if (pixbuf) {
+        gtk_status_icon_set_from_pixbuf(tray_icon, pixbuf);
+    } else {
+        gtk_status_icon_set_from_icon_name(tray_icon, name);
+    }
+    STAT_INC(tray_updates);
+    snprintf(tray_shown_icon, sizeof(tray_shown_icon), "%s", name);
+}
+
+static void set_tray_tooltip(const char *tooltip) {
+    if (strcmp(tooltip, tray_shown_tooltip) == 0) return;
+    
+    gtk_status_icon_set_tooltip_text(tray_icon, tooltip);
+    STAT_INC(tray_updates);
+    snprintf(tray_shown_tooltip, sizeof(tray_shown_tooltip), "%s", tooltip);
+}
+
+static gboolean on_tray_size_changed(GtkStatusIcon *status_icon, gint size, gpointer data) {
+    clear_tray_icon_cache();
+    update_tray_icon(last_status);
+    return TRUE;
+}
+
+static void on_icon_theme_changed(GtkIconTheme *theme, gpointer data) {
+    clear_tray_icon_cache();
+    update_tray_icon(last_status);
+}
+
+// Update the system tray icon
+static void update_tray_icon(BatteryStatus status) {
+    if (!tray_icon) return;
+    
+    char tooltip[256], remaining[64] = "";
+    const char *icon;
+    
+    if (status.time_remaining > 0) {
+        char duration[32];
+        format_time_remaining(status.time_remaining, duration, sizeof(duration));
+        snprintf(remaining, sizeof(remaining), status.charging ? " (%s to full)" : " (%s left)", duration);
+    }
+    
+    // The debounced state, so jitter at a threshold doesn't flip the icon every check;
+    // the raw tests only stand in until the first sample has been classified
+    AlertState shown = alert_state;
+    if (shown == ALERT_UNKNOWN) {
+        shown = status.charging ? ALERT_CHARGING : battery_is_critical(&status) ? ALERT_CRITICAL :
+                battery_is_low(&status) ? ALERT_LOW : ALERT_NORMAL;
+    }
+    
+    if (!status.present) {
+        icon = "battery-missing";
+        strcpy(tooltip, "🔋 No battery detected");
+    } else if (shown == ALERT_CHARGING) {
+        icon = config.icon_charging;
+        snprintf(tooltip, sizeof(tooltip), "🔌 Charging: %d%%%s", status.percentage, remaining);
+    } else if (shown == ALERT_CRITICAL) {
+        icon = config.icon_low;
+        snprintf(tooltip, sizeof(tooltip), "🚨 CRITICAL: %d%%%s - GET A CHARGER NOW!", status.percentage, remaining);
+    } else if (shown == ALERT_LOW) {
+        icon = config.icon_low;
+        snprintf(tooltip, sizeof(tooltip), "⚠️ Low: %d%%%s - Consider charging", status.percentage, remaining);
+    } else {
+        icon = config.icon_battery;
+        snprintf(tooltip, sizeof(tooltip), "🔋 Battery: %d%%%s", status.percentage, remaining);
+    }
+    
+    set_tray_icon(icon);
+    set_tray_tooltip(tooltip);
+}
+
+// Start the next queued notification; Notify calls run one at a time, asynchronously
+static void pump_notifications(void);
+
+static void on_notification_shown(GObject *source, GAsyncResult *res, gpointer data) {
+    NotificationSlot *slot = data;
+    GError *error = NULL;
+    
+    GVariant *reply = g_dbus_proxy_call_finish(G_DBUS_PROXY(source), res, &error);
+    if (reply) {
+        g_variant_get(reply, "(u)", &slot->id);
+        g_variant_unref(reply);
+        STAT_INC(notifications);
+    } else {
+        log_warning("notification", "❌ Failed to show notification: %s", error->message);
+        g_error_free(error);
+        // The server may have restarted; start from a fresh bubble next time
+        slot->id = 0;
+    }
+    
+    notification_in_flight = 0;
+    pump_notifications();
+}
+
+static void pump_notifications(void) {
+    if (notification_in_flight || !notify_proxy) return;
+    
+    // Critical first, so a queued informational bubble never delays it
+    for (int i = 0; i < NOTIFY_CLASS_COUNT; i++) {
+        NotificationSlot *slot = &notification_slots[i];
+        if (!slot->pending) continue;
+        slot->pending = 0;
+        
+        // Set urgency
+        GVariantBuilder hints;
+        g_variant_builder_init(&hints, G_VARIANT_TYPE("a{sv}"));
+        g_variant_builder_add(&hints, "{sv}", "urgency", g_variant_new_byte(slot->critical ? 2 : 1));
+        static const gchar *const no_actions[] = { NULL };
+        
+        notification_in_flight = 1;
+        g_dbus_proxy_call(notify_proxy, "Notify",
+                          g_variant_new("(susss^asa{sv}i)", "Cool Little Battery Monitor", slot->id,
+                                        "battery-caution", slot->title, slot->message, no_actions, &hints,
+                                        slot->critical ? config.alert_timeout * 1000 : 5000),
+                          G_DBUS_CALL_FLAGS_NONE, -1, NULL, on_notification_shown, slot);
+        return;
+    }
+}
+
+static void on_notify_proxy_ready(GObject *source, GAsyncResult *res, gpointer data) {
+    GError *error = NULL;
+    notify_proxy_pending = 0;
+    notify_proxy = g_dbus_proxy_new_for_bus_finish(res, &error);
+    if (!notify_proxy) {
+        // Try again with the next alert
+        log_error(NULL, "❌ Failed to connect to the notification server: %s", error->message);
+        g_error_free(error);
+        return;
+    }
+    
+    pump_notifications();
+}
+
+// Show desktop notification
+static void show_notification(NotifyClass category, const char *title, const char *message, const char *urgency) {
+    // The replay harness only wants to know when each alert class first fired
+    if (harness_active) {
+        if (category == NOTIFY_CLASS_WARNING && harness_warning_sample < 0) {
+            harness_warning_sample = harness_sample;
+        } else if (category == NOTIFY_CLASS_CRITICAL && harness_critical_sample < 0) {
+            harness_critical_sample = harness_sample;
+        }
+        return;
+    }
+    
+    // Every alert is logged, rate limited per class so a flapping battery can't flood the journal.
+    // No notification server on headless boxes, so there the log is where alerts are read.
+    static const struct {
+        int priority;
+        const char *key;
+    } alert_log[NOTIFY_CLASS_COUNT] = {
+        [NOTIFY_CLASS_CRITICAL] = { LOG_CRIT, "alert-critical" },
+        [NOTIFY_CLASS_WARNING] = { LOG_WARNING, "alert-warning" },
+        [NOTIFY_CLASS_INFO] = { LOG_INFO, "alert-info" },
+    };
+    log_write(alert_log[category].priority, alert_log[category].key, __func__, "%s: %s", title, message);
+    if (headless_mode) return;
+    
+    // Only the latest text of each category matters, older queued text is overwritten
+    NotificationSlot *slot = &notification_slots[category];
+    snprintf(slot->title, sizeof(slot->title), "%s", title);
+    snprintf(slot->message, sizeof(slot->message), "%s", message);
+    slot->critical = (strcmp(urgency, "critical") == 0);
+    slot->pending = 1;
+    
+    if (!notify_proxy && !notify_proxy_pending) {
+        notify_proxy_pending = 1;
+        g_dbus_proxy_new_for_bus(G_BUS_TYPE_SESSION,
+                                 G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES | G_DBUS_PROXY_FLAGS_DO_NOT_CONNECT_SIGNALS,
+                                 NULL,
+                                 "org.freedesktop.Notifications",
+                                 "/org/freedesktop/Notifications",
+                                 "org.freedesktop.Notifications",
+                                 NULL,
+                                 on_notify_proxy_ready,
+                                 NULL);
+    }
+    pump_notifications();
+}
+
+// Alert dialog responses arrive here instead of through a nested gtk_dialog_run loop
+static void on_alert_response(GtkDialog *dialog, gint response_id, gpointer data) {
+    gtk_widget_hide(GTK_WIDGET(dialog));
+    alert_active = 0;
+}
+
+// Show impossible to dismiss alert dialog
+static void show_impossible_alert(const char *title, const char *message) {
+    if (!config.impossible_alerts || headless_mode) return;
+    
+    // One persistent dialog, built on first use and reused for every alert
+    if (!alert_dialog) {
+        alert_dialog = gtk_message_dialog_new(NULL,
+                                            GTK_DIALOG_DESTROY_WITH_PARENT,
+                                            GTK_MESSAGE_WARNING,
+                                            GTK_BUTTONS_OK,
+                                            "%s", title);
+        
+        // Make it stay on top and grab focus
+        gtk_window_set_keep_above(GTK_WINDOW(alert_dialog), TRUE);
+        gtk_window_set_position(GTK_WINDOW(alert_dialog), GTK_WIN_POS_CENTER_ALWAYS);
+        
+        g_signal_connect(alert_dialog, "response", G_CALLBACK(on_alert_response), NULL);
+        g_signal_connect(alert_dialog, "delete-event", G_CALLBACK(gtk_widget_hide_on_delete), NULL);
+    }
+    
+    // Update the text in place rather than rebuilding the widget
+    g_object_set(alert_dialog, "text", title, "secondary-text", message, NULL);
+    gtk_window_set_urgency_hint(GTK_WINDOW(alert_dialog), TRUE);
+    gtk_window_present(GTK_WINDOW(alert_dialog));
+    
+    alert_active = 1;
+}
+
+// Hide the alert dialog once the battery is safe again, keeping it for reuse
+static void hide_impossible_alert(void) {
+    alert_active = 0;
+    if (alert_dialog && gtk_widget_get_visible(alert_dialog)) {
+        gtk_widget_hide(alert_dialog);
+    }
+}
+
+// Suspend backends, indexed by config.suspend_method. Each is probed once when logind
+// has answered, and remembers how long its last successful request took.
+typedef struct {
+    const char *name;           // Logs and the status window
+    const char *label;          // Suspend method dialog
+    gboolean (*probe)(void);
+    gboolean (*suspend)(void);  // Start a suspend; FALSE if it failed synchronously
+    int available;              // Probe result, -1 until probed
+    gint64 latency_us;          // Request to acknowledgement, 0 until measured
+} SuspendBackend;
+
+static SuspendBackend suspend_backends[] = {
+    { "systemctl suspend", "systemctl suspend (Systemd)", probe_systemctl, suspend_via_systemctl, -1, 0 },
+    { "pm-suspend", "pm-suspend (PM Utils)", probe_pm_utils, suspend_via_pm_utils, -1, 0 },
+    { "D-Bus (logind)", "D-Bus (Login Manager)", probe_logind, suspend_via_logind, -1, 0 },
+    { "Kernel Direct", "Kernel Direct (/sys/power/state)", probe_kernel, suspend_via_kernel, -1, 0 },
+};
+
+#define SUSPEND_BACKEND_COUNT ((int)G_N_ELEMENTS(suspend_backends))
+
+// Suspend request in flight: the selected method first, then optional fallbacks
+typedef struct {
+    int active;
+    int order[SUSPEND_BACKEND_COUNT];
+    int count;
+    int next;
+    int current;        // Backend being tried, -1 for a hibernate
+    int logind_tried;   // systemctl and D-Bus both end up at logind, only ask it once
+    int test;           // From Test Suspend, report the latencies afterwards
+    gint64 started;     // Monotonic time the request was made
+    gint64 attempt_started;
+} SuspendRequest;
+
+static SuspendRequest suspend_request = {0};
+
+static void on_logind_proxy_ready(GObject *source, GAsyncResult *res, gpointer data) {
+    GError *error = NULL;
+    logind_proxy = g_dbus_proxy_new_for_bus_finish(res, &error);
+    if (!logind_proxy) {
+        log_warning(NULL, "❌ logind unavailable, suspend will use fallback commands: %s", error->message);
+        g_error_free(error);
+    } else {
+        g_signal_connect(logind_proxy, "g-signal", G_CALLBACK(on_logind_signal), NULL);
+    }
+    
+    // Whether logind is there decides half of the backends
+    probe_suspend_backends();
+}
+
+// Connect to logind once at startup so a critical suspend is a single D-Bus call
+static void setup_logind_proxy(void) {
+    g_dbus_proxy_new_for_bus(G_BUS_TYPE_SYSTEM,
+                             G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES | G_DBUS_PROXY_FLAGS_DO_NOT_AUTO_START,
+                             NULL,
+                             "org.freedesktop.login1",
+                             "/org/freedesktop/login1",
+                             "org.freedesktop.login1.Manager",
+                             NULL,
+                             on_logind_proxy_ready,
+                             NULL);
+}
+
+// Probes, cheap enough to run on the main loop: a PATH lookup or a tiny sysfs read
+static gboolean probe_program(const char *program) {
+    gchar *path = g_find_program_in_path(program);
+    gboolean found = path != NULL;
+    g_free(path);
+    return found;
+}
+
+static gboolean probe_systemctl(void) {
+    return logind_proxy || probe_program("systemctl");
+}
+
+static gboolean probe_pm_utils(void) {
+    return probe_program("pm-suspend");
+}
+
+static gboolean probe_logind(void) {
+    if (!logind_proxy) return FALSE;
+    gchar *owner = g_dbus_proxy_get_name_owner(logind_proxy);
+    gboolean owned = owner != NULL;
+    g_free(owner);
+    return owned;
+}
+
+static gboolean probe_kernel(void) {
+    char states[64];
+    return access("/sys/power/state", W_OK) == 0 &&
+           read_sysfs_file("/sys/power", "state", states, sizeof(states)) > 0 && strstr(states, "mem");
+}
+
+static void probe_suspend_backends(void) {
+    for (int i = 0; i < SUSPEND_BACKEND_COUNT; i++) {
+        suspend_backends[i].available = suspend_backends[i].probe();
+        log_debug(NULL, "%s Suspend method %s", suspend_backends[i].available ? "✅" : "❌", suspend_backends[i].name);
+    }
+}
+
+// One line per backend: availability and measured latency
+static void format_suspend_backends(char *buf, size_t size) {
+    size_t used = 0;
+    buf[0] = '\0';
+    for (int i = 0; i < SUSPEND_BACKEND_COUNT && used < size; i++) {
+        const SuspendBackend *backend = &suspend_backends[i];
+        char latency[32];
+        if (backend->available == 0) {
+            snprintf(latency, sizeof(latency), "unavailable");
+        } else if (backend->latency_us > 0) {
+            snprintf(latency, sizeof(latency), "%.0f ms", backend->latency_us / 1000.0);
+        } else {
+            snprintf(latency, sizeof(latency), "not measured");
+        }
+        used += snprintf(buf + used, size - used, "%s%s %s: %s", i ? "\n" : "",
+                         backend->available == 0 ? "❌" : "✅", backend->name, latency);
+    }
+}
+
+static void finish_suspend_request(gboolean success) {
+    if (success) {
+        gint64 now = g_get_monotonic_time();
+        guint64 latency = now - suspend_request.started;
+        STAT_SET(suspend_latency_last_us, latency);
+        STAT_MAX(suspend_latency_max_us, latency);
+        if (suspend_request.current >= 0) {
+            suspend_backends[suspend_request.current].latency_us = now - suspend_request.attempt_started;
+        }
+    } else {
+        STAT_INC(suspend_failures);
+        log_error("suspend", "❌ All suspend methods failed!");
+    }
+    suspend_request.active = 0;
+    
+    if (suspend_request.test) {
+        char report[512];
+        format_suspend_backends(report, sizeof(report));
+        show_notification(NOTIFY_CLASS_INFO, success ? "🧪 Suspend Test Finished" : "🧪 Suspend Test Failed",
+                          report, "normal");
+    }
+}
+
+static void on_logind_suspend_done(GObject *source, GAsyncResult *res, gpointer data) {
+    GError *error = NULL;
+    GVariant *reply = g_dbus_proxy_call_finish(G_DBUS_PROXY(source), res, &error);
+    
+    if (reply) {
+        g_variant_unref(reply);
+        finish_suspend_request(TRUE);
+        return;
+    }
+    
+    log_warning("suspend", "❌ logind suspend failed: %s", error->message);
+    g_error_free(error);
+    try_next_suspend_method();
+}
+
+static void on_suspend_child_exit(GPid pid, gint wait_status, gpointer data) {
+    g_spawn_close_pid(pid);
+    
+    if (WIFEXITED(wait_status) && WEXITSTATUS(wait_status) == 0) {
+        finish_suspend_request(TRUE);
+    } else {
+        try_next_suspend_method();
+    }
+}
+
+// Run a suspend helper directly, without a shell in between; on_exit sees its status
+static gboolean spawn_suspend_command(const char *program, const char *arg, GChildWatchFunc on_exit) {
+    const char *argv[] = { program, arg, NULL };
+    GError *error = NULL;
+    GPid pid;
+    
+    if (!g_spawn_async(NULL, (gchar **)argv, NULL,
+                       G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD,
+                       NULL, NULL, &pid, &error)) {
+        log_warning("suspend", "❌ Failed to run %s: %s", program, error->message);
+        g_error_free(error);
+        return FALSE;
+    }
+    
+    g_child_watch_add(pid, on_exit, (gpointer)arg);
+    return TRUE;
+}
+
+// systemctl and D-Bus both end up at logind; ask it once per request
+static gboolean suspend_via_logind(void) {
+    if (!logind_proxy || suspend_request.logind_tried) return FALSE;
+    
+    suspend_request.logind_tried = 1;
+    g_dbus_proxy_call(logind_proxy, "Suspend", g_variant_new("(b)", TRUE),
+                      G_DBUS_CALL_FLAGS_NONE, -1, NULL, on_logind_suspend_done, NULL);
+    return TRUE;
+}
+
+// systemctl only forwards to logind, so skip the process when connected
+static gboolean suspend_via_systemctl(void) {
+    if (logind_proxy) return suspend_via_logind();
+    return spawn_suspend_command("systemctl", "suspend", on_suspend_child_exit);
+}
+
+static gboolean suspend_via_pm_utils(void) {
+    return spawn_suspend_command("pm-suspend", NULL, on_suspend_child_exit);
+}
+
+// Write "mem" to /sys/power/state ourselves instead of through echo. The write only
+// returns after resume, so it runs on a worker like the other slow paths and the loop
+// keeps dispatching until the machine is actually down. The monotonic clock stands
+// still while suspended, so the latency is still request to acknowledgement.
+static void kernel_suspend_thread(GTask *task, gpointer source, gpointer task_data, GCancellable *cancellable) {
+    int fd = open("/sys/power/state", O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        int err = errno;
+        g_task_return_new_error(task, G_IO_ERROR, g_io_error_from_errno(err),
+                                "Cannot open /sys/power/state: %s", strerror(err));
+        return;
+    }
+    
+    ssize_t written = write(fd, "mem", 3);
+    int saved_errno = errno;
+    close(fd);
+    
+    if (written != 3) {
+        g_task_return_new_error(task, G_IO_ERROR, g_io_error_from_errno(saved_errno),
+                                "Kernel suspend failed: %s", strerror(saved_errno));
+        return;
+    }
+    g_task_return_boolean(task, TRUE);
+}
+
+static void on_kernel_suspend_done(GObject *source, GAsyncResult *res, gpointer data) {
+    GError *error = NULL;
+    if (g_task_propagate_boolean(G_TASK(res), &error)) {
+        finish_suspend_request(TRUE);
+        return;
+    }
+    
+    log_warning("suspend", "❌ %s", error->message);
+    g_error_free(error);
+    try_next_suspend_method();
+}
+
+static gboolean suspend_via_kernel(void) {
+    GTask *task = g_task_new(NULL, NULL, on_kernel_suspend_done, NULL);
+    g_task_run_in_thread(task, kernel_suspend_thread);
+    g_object_unref(task);
+    return TRUE;
+}
+
+// Advance the fallback chain until a method is started or none are left
+static void try_next_suspend_method(void) {
+    while (suspend_request.next < suspend_request.count) {
+        int method = suspend_request.order[suspend_request.next++];
+        if (suspend_request.next > 1) {
+            log_warning("suspend", "❌ Previous suspend method failed, trying fallback...");
+        }
+        log_info("suspend", "🔋 Using suspend method: %s", suspend_backends[method].name);
+        STAT_INC(suspend_attempts);
+        suspend_request.current = method;
+        suspend_request.attempt_started = g_get_monotonic_time();
+        if (suspend_backends[method].suspend()) {
+            return;
+        }
+    }
+    
+    finish_suspend_request(FALSE);
+}
+
+// Fallbacks go fastest measured first, then unmeasured, and never to a backend the
+// probe found missing
+static int compare_suspend_fallbacks(const void *a, const void *b) {
+    const SuspendBackend *x = &suspend_backends[*(const int *)a];
+    const SuspendBackend *y = &suspend_backends[*(const int *)b];
+    gint64 lx = x->latency_us > 0 ? x->latency_us : G_MAXINT64;
+    gint64 ly = y->latency_us > 0 ? y->latency_us : G_MAXINT64;
+    if (lx != ly) return lx < ly ? -1 : 1;
+    return *(const int *)a - *(const int *)b;
+}
+
+// Kick off an asynchronous suspend, never blocking the main loop
+static void request_system_suspend(int method, gboolean with_fallbacks) {
+    if (suspend_request.active) {
+        log_info(NULL, "🔋 Suspend already in progress");
+        return;
+    }
+    if (method < 0 || method >= SUSPEND_BACKEND_COUNT) {
+        method = 0;
+    }
+    
+    memset(&suspend_request, 0, sizeof(suspend_request));
+    suspend_request.active = 1;
+    suspend_request.started = g_get_monotonic_time();
+    suspend_request.test = !with_fallbacks;
+    if (suspend_backends[method].available != 0 || !with_fallbacks) {
+        suspend_request.order[suspend_request.count++] = method;
+    } else {
+        log_warning(NULL, "❌ Suspend method %s is not available here", suspend_backends[method].name);
+    }
+    if (with_fallbacks) {
+        int first = suspend_request.count;
+        for (int i = 0; i < SUSPEND_BACKEND_COUNT; i++) {
+            if (i != method && suspend_backends[i].available != 0) {
+                suspend_request.order[suspend_request.count++] = i;
+            }
+        }
+        qsort(suspend_request.order + first, suspend_request.count - first, sizeof(int),
+              compare_suspend_fallbacks);
+    }
+    
+    try_next_suspend_method();
+}
+
+// Hibernate escalation: a critical suspend also sets an RTC alarm for when the battery
+// should reach hibernate_level, judged from how fast it drains while asleep. If that
+// alarm is what wakes the machine and the battery really is that low, logind hibernates.
+static gboolean write_rtc_wakealarm(const char *value) {
+    int fd = open(RTC_WAKEALARM, O_WRONLY | O_CLOEXEC);
+    if (fd < 0 || write(fd, value, strlen(value)) < 0) {
+        log_warning("hibernate", "❌ Cannot set %s: %s", RTC_WAKEALARM, strerror(errno));
+        if (fd >= 0) close(fd);
+        return FALSE;
+    }
+    close(fd);
+    return TRUE;
+}
+
+static void arm_hibernate_wake(int percentage) {
+    if (config.hibernate_level <= 0 || percentage <= config.hibernate_level) return;
+    
+    // Wake a little early, the next sleep refines the drain estimate
+    double seconds = (percentage - config.hibernate_level) / sleep_drain_rate * 0.75;
+    if (seconds < HIBERNATE_WAKE_MIN) seconds = HIBERNATE_WAKE_MIN;
+    if (seconds > HIBERNATE_WAKE_MAX) seconds = HIBERNATE_WAKE_MAX;
+    
+    // The kernel refuses a new alarm while one is pending, so clear it first
+    char value[32];
+    snprintf(value, sizeof(value), "+%d", (int)seconds);
+    if (write_rtc_wakealarm("0") && write_rtc_wakealarm(value)) {
+        hibernate_wake_at = g_get_real_time() / G_USEC_PER_SEC + (gint64)seconds;
+        log_info("hibernate", "⏰ Waking in %dm to check whether to hibernate", (int)seconds / 60);
+    }
+}
+
+static void disarm_hibernate_wake(void) {
+    if (!hibernate_wake_at) return;
+    hibernate_wake_at = 0;
+    write_rtc_wakealarm("0");
+}
+
+static int battery_needs_hibernate(const BatteryStatus *status) {
+    return config.hibernate_level > 0 && status->present && !status->charging &&
+           status->percentage <= config.hibernate_level;
+}
+
+// Most often no swap big enough; sleeping still beats draining awake
+static void suspend_instead_of_hibernate(void) {
+    suspend_request.active = 0;
+    request_system_suspend(config.suspend_method, TRUE);
+}
+
+static void on_hibernate_done(GObject *source, GAsyncResult *res, gpointer data) {
+    GError *error = NULL;
+    GVariant *reply = g_dbus_proxy_call_finish(G_DBUS_PROXY(source), res, &error);
+    
+    if (reply) {
+        g_variant_unref(reply);
+        finish_suspend_request(TRUE);
+        return;
+    }
+    
+    log_warning("hibernate", "❌ %s failed, suspending instead: %s", (const char *)data, error->message);
+    g_error_free(error);
+    suspend_instead_of_hibernate();
+}
+
+// systemctl without logind has no other methods queued, so a failure falls back here too
+static void on_hibernate_child_exit(GPid pid, gint wait_status, gpointer data) {
+    g_spawn_close_pid(pid);
+    
+    if (WIFEXITED(wait_status) && WEXITSTATUS(wait_status) == 0) {
+        finish_suspend_request(TRUE);
+        return;
+    }
+    
+    log_warning("hibernate", "❌ systemctl %s failed, suspending instead", (const char *)data);
+    suspend_instead_of_hibernate();
+}
+
+static void request_hibernate(void) {
+    static const struct {
+        const char *logind_method;
+        const char *systemctl_verb;
+    } hibernate_methods[] = {
+        { "Hibernate", "hibernate" },
+        { "SuspendThenHibernate", "suspend-then-hibernate" },
+        { "HybridSleep", "hybrid-sleep" },
+    };
+    
+    if (suspend_request.active) {
+        log_info(NULL, "🔋 Suspend already in progress");
+        return;
+    }
+    int method = config.hibernate_method;
+    if (method < 0 || method >= (int)G_N_ELEMENTS(hibernate_methods)) method = 0;
+    
+    log_info("hibernate", "🔋 Using hibernate method: %s", hibernate_methods[method].systemctl_verb);
+    memset(&suspend_request, 0, sizeof(suspend_request));
+    suspend_request.active = 1;
+    suspend_request.current = -1;
+    suspend_request.started = g_get_monotonic_time();
+    STAT_INC(suspend_attempts);
+    
+    if (logind_proxy) {
+        g_dbus_proxy_call(logind_proxy, hibernate_methods[method].logind_method, g_variant_new("(b)", TRUE),
+                          G_DBUS_CALL_FLAGS_NONE, -1, NULL, on_hibernate_done,
+                          (gpointer)hibernate_methods[method].logind_method);
+    } else if (!spawn_suspend_command("systemctl", hibernate_methods[method].systemctl_verb,
+                                      on_hibernate_child_exit)) {
+        log_warning("hibernate", "❌ Cannot hibernate, suspending instead");
+        suspend_instead_of_hibernate();
+    }
+}
+
+// Back from sleep: learn the sleeping drain, then either hibernate, go back to sleep
+// until the next alarm, or stand down because a person (or a charger) woke us
+static void handle_resume(void) {
+    gint64 now = g_get_real_time() / G_USEC_PER_SEC;
+    BatteryStatus status = get_battery_status();
+    
+    if (sleep_started_percentage >= 0 && status.present && !status.charging &&
+        now - sleep_started >= HIBERNATE_WAKE_MIN && status.percentage <= sleep_started_percentage) {
+        double rate = (sleep_started_percentage - status.percentage) / (double)(now - sleep_started);
+        if (rate > 0) sleep_drain_rate = 0.5 * sleep_drain_rate + 0.5 * rate;
+    }
+    sleep_started_percentage = -1;
+    
+    if (!hibernate_wake_at) return;
+    gboolean alarm_woke = now >= hibernate_wake_at - 60;
+    disarm_hibernate_wake();
+    if (!alarm_woke || status.charging) return;
+    
+    if (battery_needs_hibernate(&status)) {
+        log_warning("hibernate", "🚨 Woke at %d%%, hibernating to keep your work safe", status.percentage);
+        request_hibernate();
+    } else {
+        log_info("hibernate", "🔋 Woke at %d%%, going back to sleep", status.percentage);
+        arm_hibernate_wake(status.percentage);
+        request_system_suspend(config.suspend_method, TRUE);
+    }
+}
+
+static void on_sleep_inhibitor_ready(GObject *source, GAsyncResult *res, gpointer data) {
+    GError *error = NULL;
+    GUnixFDList *fd_list = NULL;
+    GVariant *reply = g_dbus_proxy_call_with_unix_fd_list_finish(G_DBUS_PROXY(source), &fd_list, res, &error);
+    
+    sleep_inhibit_pending = 0;
+    if (!reply) {
+        log_warning(NULL, "❌ Failed to take sleep inhibitor: %s", error->message);
+        g_error_free(error);
+        return;
+    }
+    
+    gint32 index;
+    g_variant_get(reply, "(h)", &index);
+    int fd = g_unix_fd_list_get(fd_list, index, &error);
+    g_variant_unref(reply);
+    g_object_unref(fd_list);
+    
+    if (fd < 0) {
+        log_warning(NULL, "❌ Failed to take sleep inhibitor: %s", error->message);
+        g_error_free(error);
+        return;
+    }
+    
+    // The critical sequence may already be over by the time logind answers
+    if (sleep_inhibit_wanted) {
+        sleep_inhibit_fd = fd;
+    } else {
+        close(fd);
+    }
+}
+
+// Hold a logind delay lock so lid-close or other daemons can't suspend before we're done
+static void acquire_sleep_inhibitor(void) {
+    sleep_inhibit_wanted = 1;
+    if (!logind_proxy || sleep_inhibit_fd >= 0 || sleep_inhibit_pending) return;
+    
+    sleep_inhibit_pending = 1;
+    g_dbus_proxy_call_with_unix_fd_list(logind_proxy, "Inhibit",
+                                        g_variant_new("(ssss)", "sleep",
+                                                      "Cool Little Battery Monitor",
+                                                      "Finishing critical battery sequence",
+                                                      "delay"),
+                                        G_DBUS_CALL_FLAGS_NONE, -1, NULL, NULL,
+                                        on_sleep_inhibitor_ready, NULL);
+}
+
+// Closing the lock fd is what tells logind it may proceed
+static void release_sleep_inhibitor(void) {
+    sleep_inhibit_wanted = 0;
+    if (sleep_inhibit_fd >= 0) {
+        close(sleep_inhibit_fd);
+        sleep_inhibit_fd = -1;
+    }
+}
+
+// Last step of the critical sequence: suspend if asked to, then let go of the lock
+static void complete_critical_sequence(void) {
+    if (pre_suspend_hook_timeout_id) {
+        g_source_remove(pre_suspend_hook_timeout_id);
+        pre_suspend_hook_timeout_id = 0;
+    }
+    pre_suspend_hook_pid = 0;
+    
+    if (critical_sequence_suspend && battery_needs_hibernate(&last_status)) {
+        // Already past the point a suspend would survive the night
+        request_hibernate();
+    } else if (critical_sequence_suspend) {
+        // Suspend using selected method, falling back to the others
+        arm_hibernate_wake(last_status.percentage);
+        request_system_suspend(config.suspend_method, TRUE);
+    }
+    critical_sequence_suspend = 0;
+    
+    // Hand control back to logind as soon as the suspend is queued
+    release_sleep_inhibitor();
+}
+
+static void on_pre_suspend_hook_exit(GPid pid, gint wait_status, gpointer data) {
+    g_spawn_close_pid(pid);
+    
+    // A hook that already timed out no longer holds up the sequence
+    if (pid != pre_suspend_hook_pid) return;
+    
+    if (!WIFEXITED(wait_status) || WEXITSTATUS(wait_status) != 0) {
+        log_warning(NULL, "❌ Pre-suspend hook failed, suspending anyway");
+    }
+    complete_critical_sequence();
+}
+
+static gboolean pre_suspend_hook_timed_out(gpointer data) {
+    pre_suspend_hook_timeout_id = 0;
+    log_warning(NULL, "❌ Pre-suspend hook took longer than %ds, suspending anyway", PRE_SUSPEND_HOOK_TIMEOUT);
+    complete_critical_sequence();
+    return G_SOURCE_REMOVE;
+}
+
+// Final notification, optional pre-suspend hook, then (optionally) suspend
+static void run_critical_sequence(gboolean then_suspend) {
+    if (pre_suspend_hook_pid) {
+        critical_sequence_suspend |= then_suspend;
+        return;
+    }
+    critical_sequence_suspend = then_suspend;
+    
+    // Show final warning
+    show_notification(NOTIFY_CLASS_CRITICAL, "🚨 SYSTEM SUSPENDING NOW! 🚨", 
+                     "Battery critically low! Suspending to prevent data loss!", 
+                     "critical");
+    
+    if (config.pre_suspend_hook[0]) {
+        gchar **argv = NULL;
+        GError *error = NULL;
+        GPid pid;
+        
+        if (g_shell_parse_argv(config.pre_suspend_hook, NULL, &argv, &error) &&
+            g_spawn_async(NULL, argv, NULL, G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD,
+                          NULL, NULL, &pid, &error)) {
+            log_info(NULL, "🔋 Running pre-suspend hook: %s", config.pre_suspend_hook);
+            pre_suspend_hook_pid = pid;
+            g_child_watch_add(pid, on_pre_suspend_hook_exit, NULL);
+            pre_suspend_hook_timeout_id = g_timeout_add_seconds(PRE_SUSPEND_HOOK_TIMEOUT,
+                                                                pre_suspend_hook_timed_out, NULL);
+            g_strfreev(argv);
+            return;
+        }
+        
+        log_error(NULL, "❌ Failed to run pre-suspend hook: %s", error->message);
+        g_error_free(error);
+        g_strfreev(argv);
+    }
+    
+    complete_critical_sequence();
+}
+
+// Sleep and resume. Someone else (lid close, another power manager) may be suspending
+// while we hold the lock, and waking up may be our own hibernate alarm.
+static void on_logind_signal(GDBusProxy *proxy, gchar *sender, gchar *signal_name,
+                             GVariant *parameters, gpointer data) {
+    if (strcmp(signal_name, "PrepareForSleep") != 0) return;
+    
+    gboolean start;
+    g_variant_get(parameters, "(b)", &start);
+    
+    if (!start) {
+        handle_resume();
+        return;
+    }
+    
+    sleep_started = g_get_real_time() / G_USEC_PER_SEC;
+    sleep_started_percentage = last_status.present ? last_status.percentage : -1;
+    
+    if (sleep_inhibit_fd >= 0 && !suspend_request.active && !pre_suspend_hook_pid) {
+        log_info(NULL, "🔋 System is going to sleep, finishing critical sequence first");
+        if (critical_grace_id) {
+            g_source_remove(critical_grace_id);
+            critical_grace_id = 0;
+        }
+        run_critical_sequence(FALSE);
+    }
+}
+
+// Force system suspend
+static void force_system_suspend(void) {
+    if (harness_active) {
+        if (harness_suspend_sample < 0) harness_suspend_sample = harness_sample;
+        return;
+    }
+    
+    log_critical("suspend", "🚨 FORCING SYSTEM SUSPEND DUE TO CRITICAL BATTERY! 🚨");
+    
+    // Make sure nobody else suspends before the sequence is done
+    acquire_sleep_inhibitor();
+    run_critical_sequence(TRUE);
+}
+
+// Warning-level power saving: every configured action starts at once and reports back
+// through power_action_done(), so one slow service never holds up the others. Each
+// action remembers what it replaced and puts it back once the charger is connected.
+static void power_action_done(const char *action, GError *error) {
+    if (error) {
+        log_warning("power-actions", "❌ Power saving action %s failed: %s", action, error->message);
+        g_error_free(error);
+    }
+    
+    if (--power_actions_pending > 0) return;
+    
+    power_actions_applied = power_actions_applying;
+    log_info("power-actions", "%s", power_actions_applied ? "🔋 Power saving actions applied" : "🔌 Power saving actions undone");
+    
+    // The charger may have come and gone while a batch was still running
+    if (power_actions_wanted != power_actions_applied) {
+        start_power_actions(power_actions_wanted);
+    } else if (quit_requested) {
+        finish_quit();
+    }
+}
+
+static void on_power_action_reply(GObject *source, GAsyncResult *res, gpointer data) {
+    GError *error = NULL;
+    GVariant *reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &error);
+    if (reply) g_variant_unref(reply);
+    power_action_done(data, error);
+}
+
+// power-profiles-daemon: remember the active profile, then switch
+static void set_power_profile(GDBusConnection *bus, const char *profile) {
+    power_actions_pending++;
+    g_dbus_connection_call(bus, "net.hadess.PowerProfiles", "/net/hadess/PowerProfiles",
+                           "org.freedesktop.DBus.Properties", "Set",
+                           g_variant_new("(ssv)", "net.hadess.PowerProfiles", "ActiveProfile",
+                                         g_variant_new_string(profile)),
+                           NULL, G_DBUS_CALL_FLAGS_NONE, 5000, NULL, on_power_action_reply, "power-profile");
+}
+
+static void on_power_profile_read(GObject *source, GAsyncResult *res, gpointer data) {
+    GError *error = NULL;
+    GVariant *reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &error);
+    if (!reply) {
+        power_action_done("power-profile", error);
+        return;
+    }
+    
+    GVariant *value;
+    g_variant_get(reply, "(v)", &value);
+    snprintf(saved_power_profile, sizeof(saved_power_profile), "%s", g_variant_get_string(value, NULL));
+    g_variant_unref(value);
+    g_variant_unref(reply);
+    
+    set_power_profile(G_DBUS_CONNECTION(source), config.action_power_profile);
+    power_action_done("power-profile", NULL);
+}
+
+// Backlight through logind, which lets the session owner set it without root
+static void set_backlight(GDBusConnection *bus, const char *device, guint32 brightness) {
+    power_actions_pending++;
+    g_dbus_connection_call(bus, "org.freedesktop.login1", "/org/freedesktop/login1/session/auto",
+                           "org.freedesktop.login1.Session", "SetBrightness",
+                           g_variant_new("(ssu)", "backlight", device, brightness),
+                           NULL, G_DBUS_CALL_FLAGS_NONE, 5000, NULL, on_power_action_reply, "backlight");
+}
+
+// How sure we are a backlight drives the built-in panel, 0 = not at all. Firmware (ACPI)
+// and platform interfaces only exist for the panel; a raw one counts only when it hangs
+// off an internal eDP, LVDS or DSI connector, which rules out DDC/CI monitors.
+static int backlight_rank(const char *path) {
+    char type[32], link[320], target[256];
+    if (read_sysfs_file(path, "type", type, sizeof(type)) <= 0) return 0;
+    if (strcmp(type, "firmware") == 0) return 3;
+    if (strcmp(type, "platform") == 0) return 2;
+    if (strcmp(type, "raw") != 0) return 0;
+    
+    snprintf(link, sizeof(link), "%s/device", path);
+    ssize_t len = readlink(link, target, sizeof(target) - 1);
+    if (len <= 0) return 0;
+    target[len] = '\0';
+    return strstr(target, "-eDP-") || strstr(target, "-LVDS-") || strstr(target, "-DSI-") ? 1 : 0;
+}
+
+static void dim_backlight(GDBusConnection *bus) {
+    DIR *dir = opendir("/sys/class/backlight");
+    if (!dir) return;
+    
+    char panel[256] = "";
+    int best = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        if (entry->d_name[0] == '.') continue;
+        
+        char path[300];
+        snprintf(path, sizeof(path), "/sys/class/backlight/%s", entry->d_name);
+        int rank = backlight_rank(path);
+        if (rank > best) {
+            best = rank;
+            snprintf(panel, sizeof(panel), "%s", entry->d_name);
+        }
+    }
+    closedir(dir);
+    if (!best) return;
+    
+    char path[300], value[32];
+    long long brightness = -1, max = -1;
+    snprintf(path, sizeof(path), "/sys/class/backlight/%s", panel);
+    if (read_sysfs_file(path, "brightness", value, sizeof(value)) > 0) parse_sysfs_int(value, &brightness);
+    if (read_sysfs_file(path, "max_brightness", value, sizeof(value)) > 0) parse_sysfs_int(value, &max);
+    
+    // Only ever dim, a screen the user already turned down stays where it is
+    long long target = max * config.action_backlight / 100;
+    if (brightness > target && target > 0) {
+        snprintf(saved_backlight_device, sizeof(saved_backlight_device), "%s", panel);
+        saved_backlight = brightness;
+        set_backlight(bus, panel, (guint32)target);
+    }
+}
+
+// systemd user units, frozen instead of stopped so they resume exactly where they were
+static void on_session_bus_ready(GObject *source, GAsyncResult *res, gpointer data) {
+    GError *error = NULL;
+    GDBusConnection *bus = g_bus_get_finish(res, &error);
+    if (!bus) {
+        power_action_done("units", error);
+        return;
+    }
+    
+    const char *method = power_actions_applying ? "FreezeUnit" : "ThawUnit";
+    gchar **units = g_strsplit_set(power_actions_applying ? config.action_pause_units : frozen_units, ", ", -1);
+    for (gchar **unit = units; *unit; unit++) {
+        if (!**unit) continue;
+        power_actions_pending++;
+        g_dbus_connection_call(bus, "org.freedesktop.systemd1", "/org/freedesktop/systemd1",
+                               "org.freedesktop.systemd1.Manager", method, g_variant_new("(s)", *unit),
+                               NULL, G_DBUS_CALL_FLAGS_NONE, 5000, NULL, on_power_action_reply, "units");
+    }
+    g_strfreev(units);
+    
+    // Thaw exactly what was frozen, even if the config changes in between
+    if (power_actions_applying) {
+        snprintf(frozen_units, sizeof(frozen_units), "%s", config.action_pause_units);
+    } else {
+        frozen_units[0] = '\0';
+    }
+    
+    g_object_unref(bus);
+    power_action_done("units", NULL);
+}
+
+// energy_performance_preference on every cpufreq policy, done on a worker since
+// sysfs writes to cpufreq can block while the driver reprograms the CPUs. The worker
+// only touches its job; the saved values reach the globals in on_epp_done.
+static void epp_thread(GTask *task, gpointer source, gpointer task_data, GCancellable *cancellable) {
+    EppJob *job = task_data;
+    const char *base = "/sys/devices/system/cpu/cpufreq";
+    
+    if (job->applying) {
+        job->count = 0;
+        DIR *dir = opendir(base);
+        if (!dir) {
+            job->error = ENOENT;
+            snprintf(job->error_path, sizeof(job->error_path), "%s", base);
+            g_task_return_pointer(task, job, g_free);
+            return;
+        }
+        struct dirent *entry;
+        while ((entry = readdir(dir)) && job->count < MAX_EPP_POLICIES) {
+            if (strncmp(entry->d_name, "policy", 6) != 0) continue;
+            SavedEpp *saved = &job->saved[job->count];
+            snprintf(saved->path, sizeof(saved->path), "%s/%s", base, entry->d_name);
+            if (read_sysfs_file(saved->path, "energy_performance_preference",
+                                saved->value, sizeof(saved->value)) > 0) {
+                job->count++;
+            }
+        }
+        closedir(dir);
+    }
+    
+    for (int i = 0; i < job->count; i++) {
+        const char *value = job->applying ? job->value : job->saved[i].value;
+        snprintf(job->error_path, sizeof(job->error_path), "%s/energy_performance_preference", job->saved[i].path);
+        
+        int fd = open(job->error_path, O_WRONLY | O_CLOEXEC);
+        if (fd < 0 || write(fd, value, strlen(value)) < 0) {
+            job->error = errno;
+            if (fd >= 0) close(fd);
+            break;
+        }
+        close(fd);
+    }
+    g_task_return_pointer(task, job, g_free);
+}
+
+static void on_epp_done(GObject *source, GAsyncResult *res, gpointer data) {
+    EppJob *job = g_task_propagate_pointer(G_TASK(res), NULL);
+    GError *error = NULL;
+    
+    // Even a partly applied batch has to be put back later
+    if (job->applying) {
+        memcpy(saved_epp, job->saved, sizeof(SavedEpp) * job->count);
+        saved_epp_count = job->count;
+    } else if (!job->error) {
+        saved_epp_count = 0;
+    }
+    if (job->error) {
+        error = g_error_new(G_IO_ERROR, g_io_error_from_errno(job->error), "%s: %s",
+                            job->error_path, strerror(job->error));
+    }
+    g_free(job);
+    power_action_done("energy-performance-preference", error);
+}
+
+// Launch every configured action, or the undo of every applied one
+static void start_power_actions(gboolean apply) {
+    power_actions_applying = apply;
+    power_actions_pending = 1;  // Held until everything is launched
+    GDBusConnection *system_bus = logind_proxy ? g_dbus_proxy_get_connection(logind_proxy) : NULL;
+    
+    if (apply ? config.action_power_profile[0] != '\0' : saved_power_profile[0] != '\0') {
+        if (!system_bus) {
+            log_warning(NULL, "❌ No system bus, power profile left alone");
+        } else if (apply) {
+            power_actions_pending++;
+            g_dbus_connection_call(system_bus, "net.hadess.PowerProfiles", "/net/hadess/PowerProfiles",
+                                   "org.freedesktop.DBus.Properties", "Get",
+                                   g_variant_new("(ss)", "net.hadess.PowerProfiles", "ActiveProfile"),
+                                   G_VARIANT_TYPE("(v)"), G_DBUS_CALL_FLAGS_NONE, 5000, NULL,
+                                   on_power_profile_read, NULL);
+        } else {
+            set_power_profile(system_bus, saved_power_profile);
+            saved_power_profile[0] = '\0';
+        }
+    }
+    
+    if (apply ? config.action_backlight > 0 : saved_backlight >= 0) {
+        if (!system_bus) {
+            log_warning(NULL, "❌ No system bus, backlight left alone");
+        } else if (apply) {
+            dim_backlight(system_bus);
+        } else {
+            set_backlight(system_bus, saved_backlight_device, (guint32)saved_backlight);
+            saved_backlight = -1;
+        }
+    }
+    
+    if (apply ? config.action_pause_units[0] != '\0' : frozen_units[0] != '\0') {
+        power_actions_pending++;
+        g_bus_get(G_BUS_TYPE_SESSION, NULL, on_session_bus_ready, NULL);
+    }
+    
+    if (apply ? config.action_epp[0] != '\0' : saved_epp_count > 0) {
+        power_actions_pending++;
+        EppJob *job = g_new0(EppJob, 1);
+        job->applying = apply;
+        if (apply) {
+            snprintf(job->value, sizeof(job->value), "%s", config.action_epp);
+        } else {
+            memcpy(job->saved, saved_epp, sizeof(SavedEpp) * saved_epp_count);
+            job->count = saved_epp_count;
+        }
+        GTask *task = g_task_new(NULL, NULL, on_epp_done, NULL);
+        g_task_set_task_data(task, job, NULL);
+        g_task_run_in_thread(task, epp_thread);
+        g_object_unref(task);
+    }
+    
+    power_action_done("launch", NULL);
+}
+
+// Called each check with whether the battery is discharging at warning level
+static void update_power_actions(gboolean low_on_battery) {
+    if (harness_active || quit_requested) return;
+    
+    power_actions_wanted = low_on_battery;
+    if (power_actions_pending > 0 || power_actions_wanted == power_actions_applied) return;
+    start_power_actions(power_actions_wanted);
+}
+
+// Put everything back before exiting; TRUE while the undo is still waiting for replies
+static gboolean restore_power_actions(void) {
+    power_actions_wanted = FALSE;
+    if (power_actions_pending == 0 && power_actions_applied) {
+        start_power_actions(FALSE);
+    }
+    return power_actions_pending > 0 || power_actions_applied;
+}
+
+// One battery check: read, reschedule, update the tray and raise or clear alerts
+static void run_battery_check(void) {
+    BatteryStatus status = get_battery_status();
+    log_debug(NULL, "Check: %d%% %s, %lld power, %d battery(s)", status.percentage, status.status,
+              status.power_now, status.battery_count);
+    
+    // Plan the next wakeup from this sample
+    update_discharge_rate(status);
+    estimate_time_remaining(&status);
+    last_status = status;
+    history_append(&status);
+    observe_discharge_model(&status);
+    maybe_export_telemetry(&status);
+    update_charge_limit(&status);
+    update_process_attribution(&status);
+    
+    // Thresholds go through the debounced state machine before anything reacts to them
+    gint64 now = monitor_clock();
+    gboolean transition = status.present && update_alert_state(&status, now);
+    
+    // An expired snooze is cleared before SnoozedUntil is published
+    if (alert_snooze_until && now >= alert_snooze_until) {
+        alert_snooze_until = 0;
+        alert_snooze_until_wall = 0;
+    }
+    
+    update_power_actions(status.present && (alert_state == ALERT_LOW || alert_state == ALERT_CRITICAL));
+    refresh_status_window(status);
+    publish_status(&status);
+    emit_monitor_changes();
+    restart_battery_timer();
+    
+    if (!status.present) {
+        update_tray_icon(status);
+        return;
+    }
+    
+    // Update icon always
+    update_tray_icon(status);
+    
+    switch (alert_state) {
+    case ALERT_CRITICAL:
+        // Critical level - FORCE SUSPEND, retried every critical_repeat while it lasts
+        if (!alert_last_time || now - alert_last_time >= (gint64)config.critical_repeat * G_USEC_PER_SEC) {
+            char title[256], message[512];
+            snprintf(title, sizeof(title), "🚨 CRITICAL BATTERY: %d%% 🚨", status.percentage);
+            snprintf(message, sizeof(message), 
+                    "Your battery is critically low at %d%%!\n\n"
+                    "🔌 PLUG IN YOUR CHARGER IMMEDIATELY!\n\n"
+                    "System will suspend in 10 seconds to prevent data loss!",
+                    status.percentage);
+            
+            show_notification(NOTIFY_CLASS_CRITICAL, title, message, "critical");
+            
+            // Give user 10 seconds to plug in charger, without blocking the main loop
+            if (config.force_suspend) {
+                start_critical_grace();
+            }
+            
+            show_impossible_alert(title, message);
+            
+            alert_last_time = now;
+        }
+        break;
+        
+    case ALERT_LOW:
+        // Warning level - IMPOSSIBLE TO IGNORE ALERTS, repeated every warning_repeat
+        if (transition) {
+            cancel_critical_grace();
+        }
+        if ((!alert_last_time || now - alert_last_time >= (gint64)config.warning_repeat * G_USEC_PER_SEC) &&
+            now >= alert_snooze_until) {
+            char title[256], message[1024], consumers[512];
+            snprintf(title, sizeof(title), "⚠️ LOW BATTERY: %d%% ⚠️", status.percentage);
+            char duration[32] = "";
+            if (status.time_remaining > 0) {
+                format_time_remaining(status.time_remaining, duration, sizeof(duration));
+            }
+            format_top_processes(consumers, sizeof(consumers));
+            snprintf(message, sizeof(message), 
+                    "Your battery is getting low at %d%%%s%s%s!\n\n"
+                    "🔌 Please plug in your charger soon!\n\n"
+                    "System will force suspend at %d%% to protect your data!%s%s",
+                    status.percentage,
+                    duration[0] ? " (about " : "", duration, duration[0] ? " left)" : "",
+                    config.critical_level,
+                    consumers[0] ? "\n\n" : "", consumers);
+            
+            show_notification(NOTIFY_CLASS_WARNING, title, message, "critical");
+            show_impossible_alert(title, message);
+            
+            alert_last_time = now;
+        }
+        break;
+        
+    default:
+        // Charging, or the battery is good again: clear any active alerts once
+        if (transition) {
+            cancel_critical_grace();
+            hide_impossible_alert();
+        }
+        break;
+    }
+    
+    last_percentage = status.percentage;
+    last_charging_state = status.charging;
+}
+
+// Battery check timer callback
+static gboolean check_battery_timer(gpointer data) {
+    gint64 start = g_get_monotonic_time();
+    run_battery_check();
+    
+    guint64 elapsed = g_get_monotonic_time() - start;
+    STAT_INC(ticks);
+    STAT_ADD(tick_latency_total_us, elapsed);
+    STAT_MAX(tick_latency_max_us, elapsed);
+    STAT_MAX(max_stall_us, elapsed);
+    return TRUE;  // Continue timer
+}
+
+// Arm the one-shot suspend countdown; charger events cancel it via check_battery_timer
+static void start_critical_grace(void) {
+    if (critical_grace_id) return;
+    
+    log_warning("critical-grace", "🚨 Suspending in %d seconds unless a charger is connected", CRITICAL_GRACE_SECONDS);
+    critical_grace_started = monitor_clock();
+    acquire_sleep_inhibitor();
+    critical_grace_id = g_timeout_add_seconds(CRITICAL_GRACE_SECONDS, critical_grace_expired, NULL);
+}
+
+static void cancel_critical_grace(void) {
+    if (!critical_grace_id) return;
+    
+    g_source_remove(critical_grace_id);
+    critical_grace_id = 0;
+    release_sleep_inhibitor();
+    log_info("critical-grace", "🔌 Battery no longer critical, pending suspend cancelled");
+}
+
+static gboolean critical_grace_expired(gpointer data) {
+    critical_grace_id = 0;
+    
+    // Check again if still critical and not charging
+    BatteryStatus final_check = get_battery_status();
+    estimate_time_remaining(&final_check);
+    if (final_check.present && battery_is_critical(&final_check) && !final_check.charging) {
+        force_system_suspend();
+    } else {
+        release_sleep_inhibitor();
+    }
+    
+    return G_SOURCE_REMOVE;
+}
+
+// Track how fast the battery drains: smoothed power draw where the battery reports it,
+// otherwise the time between percentage drops
+static void update_discharge_rate(BatteryStatus status) {
+    gint64 now = monitor_clock();
+    
+    if (!status.present || status.power_now <= 0 || status.charging != smoothed_power_charging) {
+        smoothed_power = 0.0;
+    }
+    if (status.present && status.power_now > 0) {
+        if (smoothed_power <= 0) {
+            smoothed_power = status.power_now;
+        } else {
+            // Time-weighted EWMA, since the adaptive scheduler makes sample spacing uneven
+            double elapsed = (now - smoothed_power_time) / (double)G_USEC_PER_SEC;
+            double alpha = elapsed / (elapsed + POWER_SMOOTHING_SECONDS);
+            smoothed_power += alpha * (status.power_now - smoothed_power);
+        }
+        smoothed_power_time = now;
+    }
+    smoothed_power_charging = status.charging;
+    
+    if (!status.present || status.charging) {
+        discharge_rate = 0.0;
+        rate_sample_percentage = -1;
+        return;
+    }
+    
+    if (smoothed_power > 0 && status.energy_full > 0) {
+        // energy_full / power is in hours
+        discharge_rate = smoothed_power / status.energy_full * 100.0 / 3600.0;
+        rate_sample_percentage = -1;
+        return;
+    }
+    
+    if (rate_sample_percentage < 0 || status.percentage > rate_sample_percentage) {
+        rate_sample_percentage = status.percentage;
+        rate_sample_time = now;
+        return;
+    }
+    
+    if (status.percentage < rate_sample_percentage) {
+        double elapsed = (now - rate_sample_time) / (double)G_USEC_PER_SEC;
+        if (elapsed > 0) {
+            double rate = (rate_sample_percentage - status.percentage) / elapsed;
+            // The first drop after a reset only bounds the rate, so blend from the second one on
+            discharge_rate = discharge_rate > 0 ? 0.5 * discharge_rate + 0.5 * rate : rate;
+        }
+        rate_sample_percentage = status.percentage;
+        rate_sample_time = now;
+    }
+}
+
+// Seconds until the next check: just before the next threshold is predicted to be crossed
+static int compute_check_delay(void) {
+    int listening = uevent_source_id || (harness_active && config.event_driven);
+    int base = listening ? config.fallback_interval : config.check_interval;
+    if (base < config.check_interval) {
+        base = config.check_interval;
+    }
+    
+    if (!config.adaptive_interval || !last_status.present || last_status.charging) {
+        return base;
+    }
+    if (battery_is_critical(&last_status)) {
+        return ADAPTIVE_MIN_INTERVAL;
+    }
+    
+    double rate = discharge_rate;
+    if (rate > 0 && rate_sample_percentage >= 0) {
+        // Going this long without a drop caps the rate, even if the last estimate was higher
+        double elapsed = (monitor_clock() - rate_sample_time) / (double)G_USEC_PER_SEC;
+        if (elapsed > 0 && 1.0 / elapsed < rate) {
+            rate = 1.0 / elapsed;
+        }
+    }
+    if (rate <= 0) {
+        return config.check_interval;  // No estimate yet, stay conservative
+    }
+    
+    int low = battery_is_low(&last_status);
+    int target = low ? config.critical_level : config.warning_level;
+    double seconds = (last_status.percentage - target) / rate;
+    
+    // Minute thresholds may be reached before the percentage ones
+    int target_minutes = low ? config.critical_minutes : config.warning_minutes;
+    if (target_minutes > 0 && last_status.time_remaining > 0) {
+        double by_minutes = (last_status.time_remaining - target_minutes) * 60.0;
+        if (by_minutes < seconds) seconds = by_minutes;
+    }
+    
+    // So may the learned curve's shutdown prediction
+    if (config.critical_seconds > 0 && last_status.shutdown_seconds > 0) {
+        double by_model = last_status.shutdown_seconds - config.critical_seconds;
+        if (by_model < seconds) seconds = by_model;
+    }
+    
+    // Wake at 3/4 of the predicted time; each check refines the estimate as we get closer
+    double delay = seconds * 0.75;
+    if (delay < ADAPTIVE_MIN_INTERVAL) delay = ADAPTIVE_MIN_INTERVAL;
+    if (delay > ADAPTIVE_MAX_INTERVAL) delay = ADAPTIVE_MAX_INTERVAL;
+    return (int)delay;
+}
+
+// Discharge model: the energy drawn while the battery sat at each percent, learned from
+// this pack's own cycles. Summing the bins below the current one gives the energy left
+// before shutdown, which on a worn pack can be far less than capacity suggests.
+static void discharge_model_path(char *buf, size_t size) {
+    size_t len = strlen(config.config_path);
+    if (len > 5 && strcmp(config.config_path + len - 5, ".conf") == 0) len -= 5;
+    snprintf(buf, size, "%.*s.model", (int)len, config.config_path);
+}
+
+static gboolean load_discharge_model(void) {
+    char path[600];
+    discharge_model_path(path, sizeof(path));
+    
+    DischargeModel model;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return FALSE;
+    ssize_t n = read(fd, &model, sizeof(model));
+    close(fd);
+    
+    if (n != sizeof(model) || model.magic != MODEL_MAGIC || model.version != MODEL_VERSION) {
+        log_warning(NULL, "❌ Ignoring discharge model %s, it was written by another version", path);
+        return FALSE;
+    }
+    discharge_model = model;
+    return TRUE;
+}
+
+// Written whole to a temp file and renamed, like the config
+static void save_discharge_model(void) {
+    char path[600], tmp_path[610];
+    discharge_model_path(path, sizeof(path));
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        log_error(NULL, "❌ Failed to save discharge model to %s: %s", tmp_path, strerror(errno));
+        return;
+    }
+    int failed = write(fd, &discharge_model, sizeof(discharge_model)) != sizeof(discharge_model) ||
+                 fsync(fd) < 0;
+    int saved_errno = errno;
+    close(fd);
+    
+    if (failed || rename(tmp_path, path) < 0) {
+        if (!failed) saved_errno = errno;
+        log_error(NULL, "❌ Failed to save discharge model to %s: %s", path, strerror(saved_errno));
+        unlink(tmp_path);
+    }
+}
+
+// Merge the bins the finished cycle passed all the way through; the first and last
+// were only seen in part. Each bin keeps a running mean over its recent cycles.
+static void fold_discharge_cycle(void) {
+    if (model_cycle_high < 0) return;
+    
+    int folded = 0;
+    for (int bin = model_cycle_low + 1; bin < model_cycle_high; bin++) {
+        if (model_cycle_energy[bin] <= 0) continue;
+        guint8 *weight = &discharge_model.weight[bin];
+        int w = *weight < MODEL_MAX_WEIGHT ? *weight : MODEL_MAX_WEIGHT;
+        discharge_model.energy[bin] = (discharge_model.energy[bin] * w + model_cycle_energy[bin]) / (w + 1);
+        if (*weight < 255) (*weight)++;
+        folded++;
+    }
+    model_cycle_high = -1;
+    
+    if (folded) {
+        discharge_model.cycles++;
+        if (!model_bootstrapping) save_discharge_model();
+    }
+}
+
+// One sample. Only the bins the battery went through since the last one get touched.
+// time_us must keep running through suspend, so a night asleep shows up as a gap.
+static void observe_discharge_sample(gint64 time_us, int capacity, double power, int discharging) {
+    if (capacity < 0) capacity = 0;
+    if (capacity >= MODEL_BINS) capacity = MODEL_BINS - 1;
+    
+    if (!discharging || power <= 0) {
+        fold_discharge_cycle();
+        return;
+    }
+    
+    double elapsed = (time_us - model_last_time) / (double)G_USEC_PER_SEC;
+    if (model_cycle_high >= 0 &&
+        (elapsed <= 0 || elapsed > MODEL_GAP_SECONDS || capacity > model_last_capacity)) {
+        // Slept through part of it, or the gauge recalibrated upwards
+        fold_discharge_cycle();
+    }
+    
+    if (model_cycle_high < 0) {
+        memset(model_cycle_energy, 0, sizeof(model_cycle_energy));
+        model_cycle_high = capacity;
+    } else {
+        // Trapezoid over the interval, in energy_now units (power is per hour). A long
+        // interval can cross several percent; share it evenly among the bins it left.
+        double energy = (model_last_power + power) / 2.0 * elapsed / 3600.0;
+        int crossed = model_last_capacity > capacity ? model_last_capacity - capacity : 1;
+        for (int i = 0; i < crossed; i++) {
+            model_cycle_energy[model_last_capacity - i] += energy / crossed;
+        }
+    }
+    model_cycle_low = capacity;
+    model_last_capacity = capacity;
+    model_last_time = time_us;
+    model_last_power = power;
+}
+
+static void observe_discharge_model(const BatteryStatus *status) {
+    if (harness_active || !status->present) return;
+    
+    // Unlike monitor_clock(), CLOCK_BOOTTIME counts the time spent suspended
+    struct timespec now;
+    clock_gettime(CLOCK_BOOTTIME, &now);
+    observe_discharge_sample((gint64)now.tv_sec * G_USEC_PER_SEC + now.tv_nsec / 1000,
+                             status->percentage, (double)status->power_now,
+                             strcmp(status->status, "Discharging") == 0);
+}
+
+// Load the model, or learn one from whatever history is already on disk
+static void open_discharge_model(void) {
+    if (load_discharge_model()) return;
+    
+    model_bootstrapping = 1;
+    guint64 count = history_count();
+    for (guint64 i = 0; i < count; i++) {
+        const HistoryRecord *record = history_get(i);
+        observe_discharge_sample(record->timestamp, record->capacity, record->power,
+                                 record->state == HISTORY_DISCHARGING);
+    }
+    fold_discharge_cycle();
+    model_bootstrapping = 0;
+    
+    if (discharge_model.cycles) {
+        log_info(NULL, "🔋 Learned a discharge curve from %u cycles in the history", discharge_model.cycles);
+        save_discharge_model();
+    }
+}
+
+// Seconds until the battery is empty according to the learned curve, 0 if unknown.
+// Bins never seen yet are taken as an even share of energy_full.
+static int predict_shutdown_seconds(const BatteryStatus *status) {
+    if (!discharge_model.cycles || status->charging || smoothed_power <= 0) return 0;
+    
+    int capacity = status->percentage;
+    if (capacity < 0) return 0;
+    if (capacity >= MODEL_BINS) capacity = MODEL_BINS - 1;
+    double even_share = status->energy_full / 100.0;
+    
+    double remaining = 0;
+    for (int bin = 1; bin <= capacity; bin++) {
+        if (!discharge_model.weight[bin] && even_share <= 0) return 0;
+        double energy = discharge_model.weight[bin] ? discharge_model.energy[bin] : even_share;
+        
+        // Part of the current bin is already used up
+        if (bin == capacity && model_cycle_high >= 0 && model_last_capacity == capacity) {
+            energy -= model_cycle_energy[capacity];
+            if (energy < 0) energy = 0;
+        }
+        remaining += energy;
+    }
+    
+    // energy / power is in hours
+    return (int)(remaining / smoothed_power * 3600.0);
+}
+
+// Fill in time_remaining from the smoothed power draw
+static void estimate_time_remaining(BatteryStatus *status) {
+    status->time_remaining = 0;
+    status->shutdown_seconds = status->present ? predict_shutdown_seconds(status) : 0;
+    if (!status->present || smoothed_power <= 0 || status->energy_full <= 0) return;
+    
+    double energy = status->charging ? status->energy_full - status->energy_now : status->energy_now;
+    if (energy <= 0) return;
+    
+    // energy / power is in hours
+    status->time_remaining = (int)(energy / smoothed_power * 60.0 + 0.5);
+}
+
+static void format_time_remaining(int minutes, char *buf, size_t size) {
+    if (minutes >= 60) {
+        snprintf(buf, size, "%dh %02dm", minutes / 60, minutes % 60);
+    } else {
+        snprintf(buf, size, "%dm", minutes);
+    }
+}
+
+// Threshold tests shared by the tray, the alerts and the scheduler; margin widens the
+// percentage band for the hysteresis of a state already entered
+static int battery_critical_within(const BatteryStatus *status, int margin) {
+    if (status->percentage <= config.critical_level + margin) return 1;
+    if (config.critical_seconds > 0 && !status->charging &&
+        status->shutdown_seconds > 0 && status->shutdown_seconds <= config.critical_seconds) return 1;
+    return config.critical_minutes > 0 && !status->charging &&
+           status->time_remaining > 0 && status->time_remaining <= config.critical_minutes;
+}
+
+static int battery_low_within(const BatteryStatus *status, int margin) {
+    if (status->percentage <= config.warning_level + margin) return 1;
+    return config.warning_minutes > 0 && !status->charging &&
+           status->time_remaining > 0 && status->time_remaining <= config.warning_minutes;
+}
+
+static int battery_is_critical(const BatteryStatus *status) {
+    return battery_critical_within(status, 0);
+}
+
+static int battery_is_low(const BatteryStatus *status) {
+    return battery_low_within(status, 0);
+}
+
+// Alert state machine. A new state is only acted on once it has held for its debounce
+// window, and leaving a low state takes hysteresis_percent of recovery, so capacity
+// jitter at a threshold or a dock flickering between Discharging and Unknown doesn't
+// replay alerts. All times come from monitor_clock(), never the wall clock.
+static const char *alert_state_name(AlertState state) {
+    static const char *names[] = { "unknown", "normal", "low", "critical", "charging" };
+    return names[state];
+}
+
+static AlertState classify_alert_state(const BatteryStatus *status) {
+    if (status->charging) return ALERT_CHARGING;
+    
+    int band = config.hysteresis_percent > 0 ? config.hysteresis_percent : 0;
+    int holding_critical = alert_state == ALERT_CRITICAL;
+    int holding_low = alert_state == ALERT_LOW || holding_critical;
+    
+    if (battery_critical_within(status, holding_critical ? band : 0)) return ALERT_CRITICAL;
+    if (battery_low_within(status, holding_low ? band : 0)) return ALERT_LOW;
+    return ALERT_NORMAL;
+}
+
+// Debounce window for moving from the current state to candidate, in microseconds.
+// Chargers get their own, usually shorter, window since plugging in should be felt fast.
+static gint64 alert_debounce_window(AlertState candidate) {
+    int seconds = (candidate == ALERT_CHARGING || alert_state == ALERT_CHARGING) ?
+                  config.charger_debounce : config.alert_debounce;
+    return seconds > 0 ? (gint64)seconds * G_USEC_PER_SEC : 0;
+}
+
+// Feed one sample; returns TRUE when it confirmed a transition into a new alert_state
+static gboolean update_alert_state(const BatteryStatus *status, gint64 now) {
+    AlertState candidate = classify_alert_state(status);
+    
+    if (candidate == alert_state) {
+        alert_pending_since = 0;
+        return FALSE;
+    }
+    
+    // The first sample after startup has nothing to debounce against
+    if (alert_state != ALERT_UNKNOWN) {
+        if (!alert_pending_since || candidate != alert_pending) {
+            alert_pending = candidate;
+            alert_pending_since = now;
+        }
+        if (now - alert_pending_since < alert_debounce_window(candidate)) return FALSE;
+    }
+    
+    log_info("alert-state", "🔋 Battery state %s -> %s at %d%%", alert_state_name(alert_state),
+             alert_state_name(candidate), status->percentage);
+    alert_state = candidate;
+    alert_pending_since = 0;
+    alert_last_time = 0;  // The new state alerts right away
+    return TRUE;
+}
+
+// Seconds until a pending transition is due for confirmation, 0 if none is pending
+static int alert_debounce_remaining(void) {
+    if (!alert_pending_since) return 0;
+    
+    gint64 remaining = alert_pending_since + alert_debounce_window(alert_pending) - monitor_clock();
+    int seconds = (int)((remaining + G_USEC_PER_SEC - 1) / G_USEC_PER_SEC);
+    return seconds > 0 ? seconds : 1;
+}
+
+// (Re)arm the one-shot check timer. While uevents are flowing the timer is only a
+// safety net for firmware that never reports power_supply changes.
+static void restart_battery_timer(void) {
+    if (timer_id) {
+        g_source_remove(timer_id);
+        timer_id = 0;
+    }
+    
+    // A pending alert transition is confirmed by the check that ends its debounce window
+    int delay = compute_check_delay();
+    int debounce = alert_debounce_remaining();
+    if (debounce > 0 && debounce < delay) delay = debounce;
+    
+    // Under the harness the wakeup is taken on trace time instead
+    if (harness_active) {
+        harness_next_check = harness_clock + (gint64)delay * G_USEC_PER_SEC;
+        return;
+    }
+    
+    // Second granularity lets GLib batch our wakeup with other timers
+    timer_id = g_timeout_add_seconds(delay, battery_timer_fired, NULL);
+}
+
+static gboolean battery_timer_fired(gpointer data) {
+    timer_id = 0;
+    STAT_INC(timer_wakeups);
+    check_battery_timer(NULL);
+    return G_SOURCE_REMOVE;
+}
+
+// Subscribe to kernel uevents so battery changes wake us instead of a timer
+static gboolean setup_uevent_monitor(void) {
+    if (uevent_source_id) return TRUE;
+    
+    int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_KOBJECT_UEVENT);
+    if (fd < 0) {
+        log_error(NULL, "❌ Failed to open uevent socket: %s", strerror(errno));
+        return FALSE;
+    }
+    
+    struct sockaddr_nl addr = {0};
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = 1;  // Kernel broadcast group (raw uevents, no udevd needed)
+    
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        log_error(NULL, "❌ Failed to bind uevent socket: %s", strerror(errno));
+        close(fd);
+        return FALSE;
+    }
+    
+    uevent_fd = fd;
+    uevent_source_id = g_unix_fd_add(fd, G_IO_IN, on_uevent, NULL);
+    log_info(NULL, "🔋 Listening for power_supply events (fallback check every %ds)", config.fallback_interval);
+    return TRUE;
+}
+
+static void teardown_uevent_monitor(void) {
+    if (uevent_idle_id) {
+        g_source_remove(uevent_idle_id);
+        uevent_idle_id = 0;
+    }
+    if (uevent_source_id) {
+        g_source_remove(uevent_source_id);
+        uevent_source_id = 0;
+    }
+    if (uevent_fd >= 0) {
+        close(uevent_fd);
+        uevent_fd = -1;
+    }
+}
+
+// Drain the netlink socket and schedule one check per burst of battery events
+static gboolean on_uevent(gint fd, GIOCondition condition, gpointer user_data) {
+    char buf[4096];
+    gint64 start = g_get_monotonic_time();
+    
+    STAT_INC(uevents);
+    for (;;) {
+        struct sockaddr_nl sender;
+        struct iovec iov = { buf, sizeof(buf) - 1 };
+        struct msghdr msg = {0};
+        msg.msg_name = &sender;
+        msg.msg_namelen = sizeof(sender);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        
+        ssize_t len = recvmsg(fd, &msg, 0);
+        if (len < 0) {
+            if (errno == EINTR) continue;
+            if (errno == ENOBUFS) {
+                // The kernel dropped events we will never see; any of them may have been
+                // ours, hotplug included, so rescan and check now instead of at the fallback
+                log_warning("uevent", "❌ uevent socket overflowed, checking the battery now");
+                battery_handles_stale = 1;
+                if (!uevent_idle_id) {
+                    uevent_idle_id = g_idle_add(uevent_idle_check, NULL);
+                }
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            log_warning(NULL, "❌ uevent socket error: %s, falling back to polling", strerror(errno));
+            uevent_source_id = 0;
+            close(uevent_fd);
+            uevent_fd = -1;
+            restart_battery_timer();
+            return G_SOURCE_REMOVE;
+        }
+        
+        // Only trust messages from the kernel itself
+        if (msg.msg_namelen != sizeof(sender) || sender.nl_pid != 0) continue;
+        buf[len] = '\0';
+        
+        // Payload is "action@devpath" followed by NUL-separated KEY=VALUE pairs
+        for (char *field = buf; field < buf + len; field += strlen(field) + 1) {
+            if (strcmp(field, "SUBSYSTEM=power_supply") == 0) {
+                // Batteries appearing or going away invalidate the open handles
+                if (strncmp(buf, "add@", 4) == 0 || strncmp(buf, "remove@", 7) == 0) {
+                    battery_handles_stale = 1;
+                }
+                if (!uevent_idle_id) {
+                    uevent_idle_id = g_idle_add(uevent_idle_check, NULL);
+                }
+                break;
+            }
+        }
+    }
+    
+    STAT_MAX(max_stall_us, g_get_monotonic_time() - start);
+    return G_SOURCE_CONTINUE;
+}
+
+static gboolean uevent_idle_check(gpointer data) {
+    uevent_idle_id = 0;
+    check_battery_timer(NULL);
+    return G_SOURCE_REMOVE;
 }
 
 // Create the system tray menu
@@ -458,6 +4492,13 @@ static void create_menu(void) {
     g_signal_connect(suspend_item, "activate", G_CALLBACK(on_suspend_methods_clicked), NULL);
     gtk_menu_shell_append(GTK_MENU_SHELL(menu), suspend_item);
     
+    // Charge to 100% once, overriding the charge limit
+    travel_item = gtk_check_menu_item_new_with_label("🧳 Full Charge for Travel");
+    gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(travel_item), charge_travel_override);
+    gtk_widget_set_sensitive(travel_item, config.charge_limit);
+    g_signal_connect(travel_item, "toggled", G_CALLBACK(on_travel_toggled), NULL);
+    gtk_menu_shell_append(GTK_MENU_SHELL(menu), travel_item);
+    
     // Test Suspend
     GtkWidget *test_suspend_item = gtk_menu_item_new_with_label("🧪 Test Suspend");
     g_signal_connect(test_suspend_item, "activate", G_CALLBACK(on_test_suspend_clicked), NULL);
@@ -477,8 +4518,8 @@ static void create_menu(void) {
 
 // Menu callbacks
 static void on_quit_clicked(GtkMenuItem *item, gpointer data) {
-    printf("🔋 Thanks for using Cool Little Battery Monitor! Stay charged! 💕\n");
-    gtk_main_quit();
+    log_info(NULL, "🔋 Thanks for using Cool Little Battery Monitor! Stay charged! 💕");
+    quit_main_loop();
 }
 
 static void on_settings_clicked(GtkMenuItem *item, gpointer data) {
@@ -527,80 +4568,261 @@ static void on_settings_clicked(GtkMenuItem *item, gpointer data) {
     gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(alerts_check), config.impossible_alerts);
     gtk_grid_attach(GTK_GRID(grid), alerts_check, 0, 4, 2, 1);
     
+    // Event-driven updates checkbox
+    GtkWidget *events_check = gtk_check_button_new_with_label("React to battery events instead of polling");
+    gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(events_check), config.event_driven);
+    gtk_grid_attach(GTK_GRID(grid), events_check, 0, 5, 2, 1);
+    
+    // Adaptive interval checkbox
+    GtkWidget *adaptive_check = gtk_check_button_new_with_label("Adapt check interval to discharge rate");
+    gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(adaptive_check), config.adaptive_interval);
+    gtk_grid_attach(GTK_GRID(grid), adaptive_check, 0, 6, 2, 1);
+    
     gtk_widget_show_all(dialog);
     
-    if (gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT) {
-        config.warning_level = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(warning_spin));
-        config.critical_level = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(critical_spin));
-        config.check_interval = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(interval_spin));
-        config.force_suspend = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(suspend_check));
-        config.impossible_alerts = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(alerts_check));
-        
-        save_config();
+    if (gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT) {
+        BatteryConfig old = config;
+        config.warning_level = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(warning_spin));
+        config.critical_level = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(critical_spin));
+        config.check_interval = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(interval_spin));
+        // The spin ranges overlap; the file would fail validation on the next load
+        if (config.critical_level >= config.warning_level) {
+            config.critical_level = config.warning_level - 1;
+        }
+        config.force_suspend = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(suspend_check));
+        config.impossible_alerts = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(alerts_check));
+        config.event_driven = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(events_check));
+        config.adaptive_interval = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(adaptive_check));
+        
+        if (config_changed_effects(&old) & CONFIG_EFFECT_CHANGED) {
+            config_dirty = 1;
+            save_config();
+            apply_config_changes(&old);
+        }
+        
+        show_notification(NOTIFY_CLASS_INFO, "🔋 Settings Saved", "Battery monitor settings have been updated!", "normal");
+    }
+    
+    gtk_widget_destroy(dialog);
+}
+
+// Text block shown above the history graph
+static void format_status_info(BatteryStatus status, char *info, size_t size) {
+    if (!status.present) {
+        snprintf(info, size, "🔋 Cool Little Battery Monitor\n\nNo battery detected!");
+        return;
+    }
+    
+    char remaining[48] = "Unknown";
+    if (status.time_remaining > 0) {
+        char duration[32];
+        format_time_remaining(status.time_remaining, duration, sizeof(duration));
+        snprintf(remaining, sizeof(remaining), status.charging ? "%s to full" : "%s left", duration);
+    }
+    
+    snprintf(info, size, 
+            "🔋 Cool Little Battery Monitor\n\n"
+            "Battery: %d%%\n"
+            "Status: %s\n"
+            "Time Remaining: %s\n"
+            "Warning Level: %d%%\n"
+            "Critical Level: %d%%\n"
+            "Force Suspend: %s\n"
+            "Impossible Alerts: %s\n"
+            "Suspend Method: %s",
+            status.percentage,
+            status.status,
+            remaining,
+            config.warning_level,
+            config.critical_level,
+            config.force_suspend ? "Enabled" : "Disabled",
+            config.impossible_alerts ? "Enabled" : "Disabled",
+            (config.suspend_method >= 0 && config.suspend_method < SUSPEND_BACKEND_COUNT) ?
+                suspend_backends[config.suspend_method].name : "Unknown");
+    
+    char consumers[512];
+    format_top_processes(consumers, sizeof(consumers));
+    if (consumers[0]) {
+        size_t used = strlen(info);
+        snprintf(info + used, size - used, "\n\n%s", consumers);
+    }
+}
+
+// Map a timestamp and capacity onto the cached graph surface
+static double graph_x(gint64 timestamp) {
+    return (double)(timestamp - graph_origin) * graph_width / ((gint64)GRAPH_SPAN_SECONDS * G_USEC_PER_SEC);
+}
+
+static double graph_y(int capacity) {
+    return (graph_height - 1) - (double)capacity * (graph_height - 1) / 100.0;
+}
+
+// Scroll the cached surface left so the newest sample fits, keeping what's already drawn
+static void scroll_graph_surface(int shift) {
+    cairo_surface_t *scrolled = cairo_surface_create_similar(graph_surface, CAIRO_CONTENT_COLOR_ALPHA,
+                                                             graph_width, graph_height);
+    cairo_t *cr = cairo_create(scrolled);
+    cairo_set_source_surface(cr, graph_surface, -shift, 0);
+    cairo_paint(cr);
+    cairo_destroy(cr);
+    
+    cairo_surface_destroy(graph_surface);
+    graph_surface = scrolled;
+    graph_origin += (gint64)shift * GRAPH_SPAN_SECONDS * G_USEC_PER_SEC / graph_width;
+    graph_last_x -= shift;
+}
+
+// Draw every history record the surface hasn't seen yet; returns FALSE if a full rebuild is needed
+static gboolean append_graph_samples(void) {
+    guint64 head = history_head();
+    guint64 count = history_count();
+    guint64 first = head - count;
+    if (graph_drawn_head < first) graph_drawn_head = first;
+    if (graph_drawn_head >= head) return TRUE;
+    
+    // Make room for the newest sample, scrolling in steps of an eighth so it isn't done every tick
+    const HistoryRecord *newest = history_get(count - 1);
+    double newest_x = graph_x(newest->timestamp);
+    if (newest_x >= graph_width) {
+        int shift = (int)(newest_x - graph_width) + 1 + graph_width / 8;
+        if (shift >= graph_width) return FALSE;
+        scroll_graph_surface(shift);
+    }
+    
+    cairo_t *cr = cairo_create(graph_surface);
+    cairo_set_line_width(cr, 1.5);
+    cairo_set_line_cap(cr, CAIRO_LINE_CAP_ROUND);
+    
+    for (guint64 i = graph_drawn_head; i < head; i++) {
+        const HistoryRecord *record = history_get(i - first);
+        double x = graph_x(record->timestamp);
+        double y = graph_y(record->capacity);
         
-        // Restart timer with new interval
-        if (timer_id) {
-            g_source_remove(timer_id);
+        if (x >= 0 && graph_last_time &&
+            record->timestamp - graph_last_time <= (gint64)GRAPH_GAP_SECONDS * G_USEC_PER_SEC) {
+            if (record->state == HISTORY_DISCHARGING) {
+                cairo_set_source_rgb(cr, 0.95, 0.55, 0.1);
+            } else {
+                cairo_set_source_rgb(cr, 0.3, 0.75, 0.3);
+            }
+            cairo_move_to(cr, graph_last_x, graph_last_y);
+            cairo_line_to(cr, x, y);
+            cairo_stroke(cr);
         }
-        timer_id = g_timeout_add(config.check_interval * 1000, check_battery_timer, NULL);
         
-        show_notification("🔋 Settings Saved", "Battery monitor settings have been updated!", "normal");
+        graph_last_x = x;
+        graph_last_y = y;
+        graph_last_time = record->timestamp;
     }
     
-    gtk_widget_destroy(dialog);
+    cairo_destroy(cr);
+    graph_drawn_head = head;
+    return TRUE;
 }
 
-static void on_status_clicked(GtkMenuItem *item, gpointer data) {
-    BatteryStatus status = get_battery_status();
-    char info[512];
-    
-    if (status.present) {
-        const char *method_names[] = {
-            "systemctl suspend",
-            "pm-suspend",
-            "D-Bus",
-            "Kernel Direct"
-        };
-        
-        snprintf(info, sizeof(info), 
-                "🔋 Cool Little Battery Monitor\n\n"
-                "Battery: %d%%\n"
-                "Status: %s\n"
-                "Warning Level: %d%%\n"
-                "Critical Level: %d%%\n"
-                "Force Suspend: %s\n"
-                "Impossible Alerts: %s\n"
-                "Suspend Method: %s",
-                status.percentage,
-                status.status,
-                config.warning_level,
-                config.critical_level,
-                config.force_suspend ? "Enabled" : "Disabled",
-                config.impossible_alerts ? "Enabled" : "Disabled",
-                (config.suspend_method >= 0 && config.suspend_method < 4) ? 
-                    method_names[config.suspend_method] : "Unknown");
-    } else {
-        strcpy(info, "🔋 Cool Little Battery Monitor\n\nNo battery detected!");
+// Start a fresh surface covering the last GRAPH_SPAN_SECONDS and replay history into it
+static void rebuild_graph_surface(GtkWidget *widget) {
+    if (graph_surface) cairo_surface_destroy(graph_surface);
+    
+    graph_width = gtk_widget_get_allocated_width(widget);
+    graph_height = gtk_widget_get_allocated_height(widget);
+    graph_surface = gdk_window_create_similar_surface(gtk_widget_get_window(widget),
+                                                      CAIRO_CONTENT_COLOR_ALPHA,
+                                                      graph_width, graph_height);
+    graph_origin = g_get_real_time() - (gint64)GRAPH_SPAN_SECONDS * G_USEC_PER_SEC;
+    graph_last_time = 0;
+    
+    // Skip straight to the records that can land on screen
+    guint64 count = history_count();
+    guint64 skip = 0;
+    while (skip < count && history_get(count - 1 - skip)->timestamp >= graph_origin) skip++;
+    graph_drawn_head = history_head() - skip;
+    
+    append_graph_samples();
+}
+
+static void release_graph_surface(void) {
+    if (graph_surface) {
+        cairo_surface_destroy(graph_surface);
+        graph_surface = NULL;
     }
+}
+
+// Compose the background, threshold guides and cached curve; samples are never redrawn here
+static gboolean on_graph_draw(GtkWidget *widget, cairo_t *cr, gpointer data) {
+    int width = gtk_widget_get_allocated_width(widget);
+    int height = gtk_widget_get_allocated_height(widget);
     
-    GtkWidget *dialog = gtk_message_dialog_new(NULL,
-                                             GTK_DIALOG_MODAL | GTK_DIALOG_DESTROY_WITH_PARENT,
-                                             GTK_MESSAGE_INFO,
-                                             GTK_BUTTONS_OK,
-                                             "%s", info);
+    if (!graph_surface || width != graph_width || height != graph_height) {
+        rebuild_graph_surface(widget);
+    }
     
-    gtk_dialog_run(GTK_DIALOG(dialog));
-    gtk_widget_destroy(dialog);
+    gtk_render_background(gtk_widget_get_style_context(widget), cr, 0, 0, width, height);
+    
+    double dashes[] = { 4.0, 4.0 };
+    cairo_set_line_width(cr, 1.0);
+    cairo_set_dash(cr, dashes, 2, 0);
+    cairo_set_source_rgba(cr, 0.95, 0.7, 0.1, 0.6);
+    cairo_move_to(cr, 0, graph_y(config.warning_level));
+    cairo_line_to(cr, width, graph_y(config.warning_level));
+    cairo_stroke(cr);
+    cairo_set_source_rgba(cr, 0.85, 0.2, 0.2, 0.6);
+    cairo_move_to(cr, 0, graph_y(config.critical_level));
+    cairo_line_to(cr, width, graph_y(config.critical_level));
+    cairo_stroke(cr);
+    
+    cairo_set_source_surface(cr, graph_surface, 0, 0);
+    cairo_paint(cr);
+    return FALSE;
 }
 
-static void on_suspend_methods_clicked(GtkMenuItem *item, gpointer data) {
-    const char *method_names[] = {
-        "systemctl suspend (Systemd)",
-        "pm-suspend (PM Utils)",
-        "D-Bus (Login Manager)",
-        "Kernel Direct (/sys/power/state)"
-    };
+// Bring the status view up to date; called on every check while the window is showing
+static void refresh_status_window(BatteryStatus status) {
+    if (!status_window || !gtk_widget_get_visible(status_window)) return;
+    
+    char info[1280];
+    format_status_info(status, info, sizeof(info));
+    gtk_label_set_text(GTK_LABEL(status_label), info);
+    
+    if (graph_surface && !append_graph_samples()) release_graph_surface();
+    gtk_widget_queue_draw(status_graph);
+}
+
+static void on_status_clicked(GtkMenuItem *item, gpointer data) {
+    // One persistent window, hidden rather than destroyed so the graph cache survives
+    if (!status_window) {
+        status_window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+        gtk_window_set_title(GTK_WINDOW(status_window), "🔋 Battery Status");
+        gtk_window_set_position(GTK_WINDOW(status_window), GTK_WIN_POS_CENTER);
+        gtk_container_set_border_width(GTK_CONTAINER(status_window), 12);
+        g_signal_connect(status_window, "delete-event", G_CALLBACK(gtk_widget_hide_on_delete), NULL);
+        
+        GtkWidget *box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 10);
+        gtk_container_add(GTK_CONTAINER(status_window), box);
+        
+        status_label = gtk_label_new("");
+        gtk_widget_set_halign(status_label, GTK_ALIGN_START);
+        gtk_box_pack_start(GTK_BOX(box), status_label, FALSE, FALSE, 0);
+        
+        GtkWidget *graph_label = gtk_label_new("Last 12 hours (orange: discharging, green: charging)");
+        gtk_widget_set_halign(graph_label, GTK_ALIGN_START);
+        gtk_box_pack_start(GTK_BOX(box), graph_label, FALSE, FALSE, 0);
+        
+        status_graph = gtk_drawing_area_new();
+        gtk_widget_set_size_request(status_graph, 480, 160);
+        g_signal_connect(status_graph, "draw", G_CALLBACK(on_graph_draw), NULL);
+        gtk_box_pack_start(GTK_BOX(box), status_graph, TRUE, TRUE, 0);
+        
+        gtk_widget_show_all(box);
+    }
     
+    BatteryStatus status = get_battery_status();
+    estimate_time_remaining(&status);
+    gtk_window_present(GTK_WINDOW(status_window));
+    refresh_status_window(status);
+}
+
+static void on_suspend_methods_clicked(GtkMenuItem *item, gpointer data) {
     GtkWidget *dialog = gtk_dialog_new_with_buttons("💤 Suspend Method Selection",
                                                    NULL,
                                                    GTK_DIALOG_MODAL | GTK_DIALOG_DESTROY_WITH_PARENT,
@@ -616,10 +4838,11 @@ static void on_suspend_methods_clicked(GtkMenuItem *item, gpointer data) {
     gtk_box_pack_start(GTK_BOX(vbox), label, FALSE, FALSE, 0);
     
     GSList *radio_group = NULL;
-    GtkWidget *radio_buttons[4];
+    GtkWidget *radio_buttons[SUSPEND_BACKEND_COUNT];
     
-    for (int i = 0; i < 4; i++) {
-        radio_buttons[i] = gtk_radio_button_new_with_label(radio_group, method_names[i]);
+    for (int i = 0; i < SUSPEND_BACKEND_COUNT; i++) {
+        radio_buttons[i] = gtk_radio_button_new_with_label(radio_group, suspend_backends[i].label);
+        gtk_widget_set_sensitive(radio_buttons[i], suspend_backends[i].available != 0);
         radio_group = gtk_radio_button_get_group(GTK_RADIO_BUTTON(radio_buttons[i]));
         gtk_box_pack_start(GTK_BOX(vbox), radio_buttons[i], FALSE, FALSE, 0);
         
@@ -631,12 +4854,15 @@ static void on_suspend_methods_clicked(GtkMenuItem *item, gpointer data) {
     gtk_widget_show_all(dialog);
     
     if (gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT) {
-        for (int i = 0; i < 4; i++) {
+        for (int i = 0; i < SUSPEND_BACKEND_COUNT; i++) {
             if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(radio_buttons[i]))) {
-                config.suspend_method = i;
-                save_config();
-                show_notification("💤 Suspend Method Updated", 
-                                method_names[i], 
+                if (config.suspend_method != i) {
+                    config.suspend_method = i;
+                    config_dirty = 1;
+                    save_config();
+                }
+                show_notification(NOTIFY_CLASS_INFO, "💤 Suspend Method Updated", 
+                                suspend_backends[i].label, 
                                 "normal");
                 break;
             }
@@ -647,6 +4873,9 @@ static void on_suspend_methods_clicked(GtkMenuItem *item, gpointer data) {
 }
 
 static void on_test_suspend_clicked(GtkMenuItem *item, gpointer data) {
+    char backends[512];
+    format_suspend_backends(backends, sizeof(backends));
+    
     GtkWidget *dialog = gtk_message_dialog_new(NULL,
                                              GTK_DIALOG_MODAL | GTK_DIALOG_DESTROY_WITH_PARENT,
                                              GTK_MESSAGE_QUESTION,
@@ -654,12 +4883,14 @@ static void on_test_suspend_clicked(GtkMenuItem *item, gpointer data) {
                                              "🧪 Test Suspend\n\n"
                                              "This will test your selected suspend method.\n"
                                              "Your system will suspend immediately!\n\n"
-                                             "Are you sure you want to proceed?");
+                                             "%s\n\n"
+                                             "Are you sure you want to proceed?",
+                                             backends);
     
     if (gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_YES) {
         gtk_widget_destroy(dialog);
         
-        show_notification("🧪 Testing Suspend", 
+        show_notification(NOTIFY_CLASS_INFO, "🧪 Testing Suspend", 
                          "System will suspend in 3 seconds...", 
                          "normal");
         
@@ -671,107 +4902,819 @@ static void on_test_suspend_clicked(GtkMenuItem *item, gpointer data) {
 }
 
 static gboolean test_suspend_callback(gpointer data) {
-    const char *suspend_commands[] = {
-        "systemctl suspend",           // 0: systemd
-        "pm-suspend",                 // 1: pm-utils
-        "dbus-send --system --print-reply --dest=org.freedesktop.login1 /org/freedesktop/login1 \"org.freedesktop.login1.Manager.Suspend\" boolean:true",  // 2: dbus
-        "echo mem > /sys/power/state", // 3: direct kernel interface
-    };
-    
-    if (config.suspend_method >= 0 && config.suspend_method < 4) {
-        printf("🧪 Testing suspend method: %s\n", suspend_commands[config.suspend_method]);
-        system(suspend_commands[config.suspend_method]);
-    }
+    log_info(NULL, "🧪 Testing suspend method %s",
+           (config.suspend_method >= 0 && config.suspend_method < SUSPEND_BACKEND_COUNT) ?
+               suspend_backends[config.suspend_method].name : "Unknown");
+    request_system_suspend(config.suspend_method, FALSE);
     
     return FALSE; // Don't repeat
 }
 
 static void on_tray_popup(GtkStatusIcon *status_icon, guint button, guint32 activate_time, gpointer user_data) {
     if (button == 3) {  // Right click
+        // The menu isn't needed until someone opens it
+        if (!menu) {
+            create_menu();
+        }
         gtk_menu_popup(GTK_MENU(menu), NULL, NULL, gtk_status_icon_position_menu, status_icon, button, activate_time);
     }
 }
 
-// Signal handlers
+// Signal handlers, dispatched from the main loop rather than in signal context
 static void setup_signal_handlers(void) {
-    signal(SIGINT, signal_handler);
-    signal(SIGTERM, signal_handler);
+    g_unix_signal_add(SIGINT, on_quit_signal, GINT_TO_POINTER(SIGINT));
+    g_unix_signal_add(SIGTERM, on_quit_signal, GINT_TO_POINTER(SIGTERM));
+}
+
+static gboolean on_quit_signal(gpointer data) {
+    log_info(NULL, "🔋 Received signal %d, shutting down gracefully...", GPOINTER_TO_INT(data));
+    quit_main_loop();
+    return G_SOURCE_CONTINUE;
+}
+
+// Power saving is undone while the loop still runs, so its replies land before teardown;
+// the loop quits when they have, or after a couple of seconds regardless
+static gboolean on_quit_deadline(gpointer data) {
+    quit_deadline_id = 0;
+    log_warning("power-actions", "❌ Power saving actions not undone in time, exiting anyway");
+    finish_quit();
+    return G_SOURCE_REMOVE;
+}
+
+static void quit_main_loop(void) {
+    if (!main_loop) return;
+    
+    quit_requested = 1;
+    if (!restore_power_actions()) {
+        finish_quit();
+    } else if (!quit_deadline_id) {
+        quit_deadline_id = g_timeout_add_seconds(2, on_quit_deadline, NULL);
+    }
+}
+
+static void finish_quit(void) {
+    if (quit_deadline_id) {
+        g_source_remove(quit_deadline_id);
+        quit_deadline_id = 0;
+    }
+    if (main_loop) {
+        g_main_loop_quit(main_loop);
+    }
+}
+
+// Logging: one entry per call, to the journal's native socket when running under
+// systemd, else to log_file or stdout. Structured fields keep the text greppable
+// while LOG_KEY lets journalctl filter by event.
+static const char *log_level_name(int priority) {
+    static const char *names[] = { "emerg", "alert", "crit", "error", "warning", "notice", "info", "debug" };
+    return priority >= 0 && priority <= LOG_DEBUG ? names[priority] : "info";
+}
+
+// systemd sets JOURNAL_STREAM to the device:inode of the stream it connected to us
+static gboolean stderr_is_journal(void) {
+    const char *stream = getenv("JOURNAL_STREAM");
+    unsigned long long dev, ino;
+    struct stat st;
+    return stream && sscanf(stream, "%llu:%llu", &dev, &ino) == 2 &&
+           fstat(STDERR_FILENO, &st) == 0 && st.st_dev == dev && st.st_ino == ino;
+}
+
+static void close_logger(void) {
+    if (log_file) {
+        fclose(log_file);
+        log_file = NULL;
+    }
+    if (log_journal_fd >= 0) {
+        close(log_journal_fd);
+        log_journal_fd = -1;
+    }
+}
+
+// Pick the sink from the config; called at startup and when log settings change
+static void open_logger(void) {
+    close_logger();
+    log_max_priority = config.log_level > 0 ? config.log_level : LOG_INFO;
+    
+    if (config.log_file[0]) {
+        log_file = fopen(config.log_file, "ae");
+        if (log_file) {
+            // Fully buffered; warnings and worse flush straight away
+            setvbuf(log_file, NULL, _IOFBF, LOG_FILE_BUFFER);
+            return;
+        }
+        fprintf(stderr, "❌ Cannot open log file %s: %s\n", config.log_file, strerror(errno));
+    }
+    
+    if (stderr_is_journal()) {
+        struct sockaddr_un addr = { .sun_family = AF_UNIX };
+        snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", LOG_JOURNAL_SOCKET);
+        log_journal_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (log_journal_fd >= 0 && connect(log_journal_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            close(log_journal_fd);
+            log_journal_fd = -1;
+        }
+    }
+}
+
+// Native journal protocol: KEY=value lines, with MESSAGE length-prefixed so it may span lines
+static gboolean send_journal_entry(int priority, const char *key, const char *func, const char *message) {
+    char header[256];
+    int header_len = snprintf(header, sizeof(header),
+                              "PRIORITY=%d\nSYSLOG_IDENTIFIER=cool-little-battery-monitor\nCODE_FUNC=%s\n%s%s%sMESSAGE\n",
+                              priority, func, key ? "LOG_KEY=" : "", key ? key : "", key ? "\n" : "");
+    if (header_len < 0 || header_len >= (int)sizeof(header)) return FALSE;
+    
+    guint64 length = GUINT64_TO_LE(strlen(message));
+    struct iovec iov[] = {
+        { header, header_len },
+        { &length, sizeof(length) },
+        { (void *)message, strlen(message) },
+        { "\n", 1 },
+    };
+    return writev(log_journal_fd, iov, G_N_ELEMENTS(iov)) >= 0;
+}
+
+// Rate limiting by key: LOG_RATE_BURST entries per LOG_RATE_WINDOW, then a count of what
+// was dropped once the window rolls over. Returns FALSE if this entry should be dropped.
+static gboolean log_rate_allows(int priority, const char *key, const char *func) {
+    gint64 now = g_get_monotonic_time();
+    LogRateLimit *slot = NULL, *oldest = &log_limits[0];
+    
+    for (int i = 0; i < LOG_RATE_SLOTS; i++) {
+        if (log_limits[i].key[0] && strcmp(log_limits[i].key, key) == 0) {
+            slot = &log_limits[i];
+            break;
+        }
+        if (log_limits[i].window_start < oldest->window_start) oldest = &log_limits[i];
+    }
+    if (!slot) {
+        slot = oldest;
+        memset(slot, 0, sizeof(*slot));
+        g_strlcpy(slot->key, key, sizeof(slot->key));
+        slot->window_start = now;
+    }
+    
+    if (now - slot->window_start >= LOG_RATE_WINDOW) {
+        int suppressed = slot->suppressed;
+        slot->window_start = now;
+        slot->count = 0;
+        slot->suppressed = 0;
+        if (suppressed) log_write(priority, NULL, func, "(%d more %s messages were suppressed)", suppressed, key);
+    }
+    
+    if (slot->count >= LOG_RATE_BURST) {
+        slot->suppressed++;
+        return FALSE;
+    }
+    slot->count++;
+    return TRUE;
+}
+
+static void log_write(int priority, const char *key, const char *func, const char *format, ...) {
+    if (priority > log_max_priority) return;
+    if (key && !log_rate_allows(priority, key, func)) return;
+    
+    char message[2048];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    
+    if (log_journal_fd >= 0 && send_journal_entry(priority, key, func, message)) return;
+    
+    if (log_file) {
+        GDateTime *now = g_date_time_new_now_local();
+        gchar *stamp = g_date_time_format(now, "%Y-%m-%dT%H:%M:%S");
+        fprintf(log_file, "%s.%03d %s%s%s%s: %s\n", stamp, g_date_time_get_microsecond(now) / 1000,
+                log_level_name(priority), key ? " [" : "", key ? key : "", key ? "]" : "", message);
+        g_free(stamp);
+        g_date_time_unref(now);
+        if (priority <= LOG_WARNING) fflush(log_file);
+        return;
+    }
+    
+    // Interactive runs read like they always have
+    printf("%s\n", message);
+}
+
+// Print how long startup took and what it cost in resident memory
+static void report_startup_metrics(void) {
+    long rss_kb = -1;
+    char line[256];
+    FILE *file = fopen("/proc/self/status", "r");
+    if (file) {
+        while (fgets(line, sizeof(line), file)) {
+            if (sscanf(line, "VmRSS: %ld kB", &rss_kb) == 1) break;
+        }
+        fclose(file);
+    }
+    
+    log_info(NULL, "⏱️ Startup took %.1f ms, RSS %ld kB",
+           (g_get_monotonic_time() - startup_begin_time) / 1000.0, rss_kb);
+}
+
+// Milliseconds since the kernel started this process, including dynamic linking
+static double process_age_ms(void) {
+    char buf[1024];
+    FILE *file = fopen("/proc/self/stat", "r");
+    if (!file) return -1;
+    size_t len = fread(buf, 1, sizeof(buf) - 1, file);
+    fclose(file);
+    buf[len] = '\0';
+    
+    // Field 22 is starttime in clock ticks since boot; skip past "(comm)" which may contain spaces
+    char *p = strrchr(buf, ')');
+    if (!p) return -1;
+    unsigned long long start_ticks;
+    if (sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %*u %*u %*d %*d %*d %*d %*d %*d %llu",
+               &start_ticks) != 1) {
+        return -1;
+    }
+    
+    struct timespec now;
+    clock_gettime(CLOCK_BOOTTIME, &now);
+    return (now.tv_sec + now.tv_nsec / 1e9) * 1000.0 - start_ticks * 1000.0 / sysconf(_SC_CLK_TCK);
+}
+
+// First time the panel embeds the icon is when the user can actually see it
+static void on_tray_embedded(GObject *object, GParamSpec *pspec, gpointer data) {
+    if (!gtk_status_icon_is_embedded(GTK_STATUS_ICON(object))) return;
+    
+    log_info(NULL, "⏱️ First icon shown %.1f ms after process start (%.1f ms after main)",
+           process_age_ms(), (g_get_monotonic_time() - startup_begin_time) / 1000.0);
+    g_signal_handlers_disconnect_by_func(object, on_tray_embedded, data);
+}
+
+// Session bus service: org.coollittlebattery on /org/coollittlebattery
+static const char dbus_introspection_xml[] =
+    "<node>"
+    "  <interface name='org.coollittlebattery.Stats'>"
+    "    <method name='GetStats'>"
+    "      <arg type='a{st}' name='counters' direction='out'/>"
+    "    </method>"
+    "  </interface>"
+    "  <interface name='org.coollittlebattery.Status'>"
+    "    <method name='GetSegmentName'>"
+    "      <arg type='s' name='name' direction='out'/>"
+    "    </method>"
+    "    <signal name='StatusChanged'>"
+    "      <arg type='u' name='sequence'/>"
+    "    </signal>"
+    "  </interface>"
+    "  <interface name='org.coollittlebattery.Monitor'>"
+    "    <property name='Present' type='b' access='read'/>"
+    "    <property name='Percentage' type='i' access='read'/>"
+    "    <property name='State' type='s' access='read'/>"
+    "    <property name='Charging' type='b' access='read'/>"
+    "    <property name='OnAC' type='b' access='read'/>"
+    "    <property name='TimeRemaining' type='i' access='read'/>"
+    "    <property name='ShutdownSeconds' type='i' access='read'/>"
+    "    <property name='Low' type='b' access='read'/>"
+    "    <property name='Critical' type='b' access='read'/>"
+    "    <property name='WarningLevel' type='i' access='read'/>"
+    "    <property name='CriticalLevel' type='i' access='read'/>"
+    "    <property name='SnoozedUntil' type='t' access='read'/>"
+    "    <property name='Config' type='a{sv}' access='read'/>"
+    "    <method name='Snooze'>"
+    "      <arg type='u' name='seconds' direction='in'/>"
+    "    </method>"
+    "    <method name='SetThresholds'>"
+    "      <arg type='i' name='warning_level' direction='in'/>"
+    "      <arg type='i' name='critical_level' direction='in'/>"
+    "    </method>"
+    "  </interface>"
+    "</node>";
+
+// Snapshot every counter as name -> value
+static GVariant *build_stats_variant(void) {
+    GVariantBuilder builder;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("a{st}"));
+    
+    for (size_t i = 0; i < sizeof(stat_fields) / sizeof(stat_fields[0]); i++) {
+        guint64 *counter = (guint64 *)((char *)&monitor_stats + stat_fields[i].offset);
+        g_variant_builder_add(&builder, "{st}", stat_fields[i].name,
+                              __atomic_load_n(counter, __ATOMIC_RELAXED));
+    }
+    
+    return g_variant_builder_end(&builder);
+}
+
+static void on_stats_method_call(GDBusConnection *connection, const gchar *sender, const gchar *object_path,
+                                 const gchar *interface_name, const gchar *method_name, GVariant *parameters,
+                                 GDBusMethodInvocation *invocation, gpointer data) {
+    if (strcmp(method_name, "GetStats") == 0) {
+        g_dbus_method_invocation_return_value(invocation, g_variant_new("(@a{st})", build_stats_variant()));
+    } else {
+        g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD,
+                                              "Unknown method %s", method_name);
+    }
+}
+
+static const GDBusInterfaceVTable stats_vtable = { on_stats_method_call, NULL, NULL, { 0 } };
+
+// Where to map the status segment from; StatusChanged fires on each new snapshot
+static void on_status_method_call(GDBusConnection *connection, const gchar *sender, const gchar *object_path,
+                                  const gchar *interface_name, const gchar *method_name, GVariant *parameters,
+                                  GDBusMethodInvocation *invocation, gpointer data) {
+    if (strcmp(method_name, "GetSegmentName") == 0) {
+        char name[64];
+        status_segment_name(name, sizeof(name));
+        g_dbus_method_invocation_return_value(invocation, g_variant_new("(s)", name));
+    } else {
+        g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD,
+                                              "Unknown method %s", method_name);
+    }
+}
+
+static const GDBusInterfaceVTable status_vtable = { on_status_method_call, NULL, NULL, { 0 } };
+
+// org.coollittlebattery.Monitor: status, thresholds and config as properties. Each
+// property's last announced value is kept, so PropertiesChanged only names the ones
+// that really moved and an idle monitor sends nothing.
+static GVariant *monitor_present(void) { return g_variant_new_boolean(last_status.present); }
+static GVariant *monitor_percentage(void) { return g_variant_new_int32(last_status.percentage); }
+static GVariant *monitor_state(void) { return g_variant_new_string(last_status.status); }
+static GVariant *monitor_charging(void) { return g_variant_new_boolean(last_status.charging); }
+static GVariant *monitor_ac_online(void) { return g_variant_new_boolean(last_status.ac_online); }
+static GVariant *monitor_time_remaining(void) { return g_variant_new_int32(last_status.time_remaining); }
+static GVariant *monitor_shutdown_seconds(void) { return g_variant_new_int32(last_status.shutdown_seconds); }
+static GVariant *monitor_low(void) {
+    return g_variant_new_boolean(last_status.present && (alert_state == ALERT_LOW || alert_state == ALERT_CRITICAL));
+}
+static GVariant *monitor_critical(void) {
+    return g_variant_new_boolean(last_status.present && alert_state == ALERT_CRITICAL);
+}
+static GVariant *monitor_warning_level(void) { return g_variant_new_int32(config.warning_level); }
+static GVariant *monitor_critical_level(void) { return g_variant_new_int32(config.critical_level); }
+static GVariant *monitor_snoozed_until(void) { return g_variant_new_uint64(alert_snooze_until_wall); }
+
+// Every persisted setting, straight from the config table
+static GVariant *monitor_config(void) {
+    GVariantBuilder builder;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+    
+    for (size_t i = 0; i < CONFIG_KEY_COUNT; i++) {
+        const ConfigKey *key = &config_keys[i];
+        const char *field = (const char *)&config + key->offset;
+        g_variant_builder_add(&builder, "{sv}", key->name,
+                              key->type == CONFIG_INT ? g_variant_new_int32(*(const int *)field)
+                                                      : g_variant_new_string(field));
+    }
+    
+    return g_variant_builder_end(&builder);
+}
+
+static const struct {
+    const char *name;
+    GVariant *(*get)(void);
+    int config;                 // Only changes in apply_config_changes, not per check
+} monitor_properties[] = {
+    { "Present", monitor_present, 0 },
+    { "Percentage", monitor_percentage, 0 },
+    { "State", monitor_state, 0 },
+    { "Charging", monitor_charging, 0 },
+    { "OnAC", monitor_ac_online, 0 },
+    { "TimeRemaining", monitor_time_remaining, 0 },
+    { "ShutdownSeconds", monitor_shutdown_seconds, 0 },
+    { "Low", monitor_low, 0 },
+    { "Critical", monitor_critical, 0 },
+    { "WarningLevel", monitor_warning_level, 1 },
+    { "CriticalLevel", monitor_critical_level, 1 },
+    { "SnoozedUntil", monitor_snoozed_until, 0 },
+    { "Config", monitor_config, 1 },
+};
+
+#define MONITOR_PROPERTY_COUNT G_N_ELEMENTS(monitor_properties)
+
+static GVariant *monitor_announced[MONITOR_PROPERTY_COUNT];  // Last value clients were told about
+
+// The status properties as plain values, so a steady check costs one memcmp
+typedef struct {
+    int present;
+    int percentage;
+    int charging;
+    int ac_online;
+    int time_remaining;
+    int shutdown_seconds;
+    int low;
+    int critical;
+    guint64 snoozed_until;
+    char state[32];
+} MonitorStatusFields;
+
+static MonitorStatusFields monitor_fields;
+static int monitor_fields_valid = 0;
+
+// Compare one group of properties with what was last announced and signal only the differences
+static void emit_monitor_properties(int config_group) {
+    if (!dbus_connection) return;
+    
+    GVariantBuilder changed;
+    g_variant_builder_init(&changed, G_VARIANT_TYPE("a{sv}"));
+    int count = 0;
+    
+    for (size_t i = 0; i < MONITOR_PROPERTY_COUNT; i++) {
+        if (monitor_properties[i].config != config_group) continue;
+        GVariant *value = g_variant_ref_sink(monitor_properties[i].get());
+        if (monitor_announced[i] && g_variant_equal(value, monitor_announced[i])) {
+            g_variant_unref(value);
+            continue;
+        }
+        
+        g_variant_builder_add(&changed, "{sv}", monitor_properties[i].name, value);
+        if (monitor_announced[i]) g_variant_unref(monitor_announced[i]);
+        monitor_announced[i] = value;
+        count++;
+    }
+    
+    if (!count) {
+        g_variant_builder_clear(&changed);
+        return;
+    }
+    g_dbus_connection_emit_signal(dbus_connection, NULL, DBUS_OBJECT_PATH, "org.freedesktop.DBus.Properties",
+                                  "PropertiesChanged",
+                                  g_variant_new("(sa{sv}as)", "org.coollittlebattery.Monitor", &changed, NULL),
+                                  NULL);
+}
+
+// Per check and after Snooze: the status properties, skipped outright when none moved
+static void emit_monitor_changes(void) {
+    if (!dbus_connection) return;
+    
+    MonitorStatusFields fields;
+    memset(&fields, 0, sizeof(fields));  // Padding takes part in the comparison
+    fields.present = last_status.present;
+    fields.percentage = last_status.percentage;
+    fields.charging = last_status.charging;
+    fields.ac_online = last_status.ac_online;
+    fields.time_remaining = last_status.time_remaining;
+    fields.shutdown_seconds = last_status.shutdown_seconds;
+    fields.low = alert_state == ALERT_LOW || alert_state == ALERT_CRITICAL;
+    fields.critical = alert_state == ALERT_CRITICAL;
+    fields.snoozed_until = alert_snooze_until_wall;
+    snprintf(fields.state, sizeof(fields.state), "%s", last_status.status);
+    
+    if (monitor_fields_valid && memcmp(&fields, &monitor_fields, sizeof(fields)) == 0) return;
+    monitor_fields = fields;
+    monitor_fields_valid = 1;
+    emit_monitor_properties(0);
+}
+
+// Config, WarningLevel and CriticalLevel, from apply_config_changes
+static void emit_monitor_config_changes(void) {
+    emit_monitor_properties(1);
+}
+
+static void clear_monitor_announced(void) {
+    monitor_fields_valid = 0;
+    for (size_t i = 0; i < MONITOR_PROPERTY_COUNT; i++) {
+        if (monitor_announced[i]) {
+            g_variant_unref(monitor_announced[i]);
+            monitor_announced[i] = NULL;
+        }
+    }
+}
+
+static GVariant *on_monitor_get_property(GDBusConnection *connection, const gchar *sender,
+                                         const gchar *object_path, const gchar *interface_name,
+                                         const gchar *property_name, GError **error, gpointer data) {
+    for (size_t i = 0; i < MONITOR_PROPERTY_COUNT; i++) {
+        if (strcmp(property_name, monitor_properties[i].name) == 0) {
+            return monitor_properties[i].get();
+        }
+    }
+    g_set_error(error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_PROPERTY, "Unknown property %s", property_name);
+    return NULL;
+}
+
+// Snooze(seconds): hold back warning-level alerts; the critical suspend still happens
+static void monitor_snooze(GVariant *parameters, GDBusMethodInvocation *invocation) {
+    guint32 seconds;
+    g_variant_get(parameters, "(u)", &seconds);
+    if (seconds > MAX_SNOOZE_SECONDS) seconds = MAX_SNOOZE_SECONDS;
+    
+    if (seconds) {
+        alert_snooze_until = monitor_clock() + (gint64)seconds * G_USEC_PER_SEC;
+        alert_snooze_until_wall = g_get_real_time() / G_USEC_PER_SEC + seconds;
+        log_info(NULL, "😴 Low battery alerts snoozed for %um", seconds / 60);
+        if (alert_state != ALERT_CRITICAL) hide_impossible_alert();
+    } else {
+        alert_snooze_until = 0;
+        alert_snooze_until_wall = 0;
+    }
+    
+    g_dbus_method_invocation_return_value(invocation, NULL);
+    emit_monitor_changes();
+}
+
+// SetThresholds(warning, critical): same ranges as the settings dialog, saved right away
+static void monitor_set_thresholds(GVariant *parameters, GDBusMethodInvocation *invocation) {
+    gint32 warning, critical;
+    g_variant_get(parameters, "(ii)", &warning, &critical);
+    
+    if (warning < 5 || warning > 95 || critical < 1 || critical > 50 || critical >= warning) {
+        g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS,
+                                              "Need 5 <= warning <= 95, 1 <= critical <= 50 and critical < warning");
+        return;
+    }
+    
+    BatteryConfig old = config;
+    config.warning_level = warning;
+    config.critical_level = critical;
+    if (config_changed_effects(&old) & CONFIG_EFFECT_CHANGED) {
+        config_dirty = 1;
+        save_config();
+        apply_config_changes(&old);  // Announces the new thresholds
+    }
+    
+    g_dbus_method_invocation_return_value(invocation, NULL);
+}
+
+static void on_monitor_method_call(GDBusConnection *connection, const gchar *sender, const gchar *object_path,
+                                   const gchar *interface_name, const gchar *method_name, GVariant *parameters,
+                                   GDBusMethodInvocation *invocation, gpointer data) {
+    if (strcmp(method_name, "Snooze") == 0) {
+        monitor_snooze(parameters, invocation);
+    } else if (strcmp(method_name, "SetThresholds") == 0) {
+        monitor_set_thresholds(parameters, invocation);
+    } else {
+        g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD,
+                                              "Unknown method %s", method_name);
+    }
 }
 
-static void signal_handler(int sig) {
-    printf("\n🔋 Received signal %d, shutting down gracefully...\n", sig);
-    gtk_main_quit();
+static const GDBusInterfaceVTable monitor_vtable = { on_monitor_method_call, on_monitor_get_property, NULL, { 0 } };
+
+// Interfaces exported on DBUS_OBJECT_PATH
+static const struct {
+    const char *name;
+    const GDBusInterfaceVTable *vtable;
+} dbus_interfaces[] = {
+    { "org.coollittlebattery.Stats", &stats_vtable },
+    { "org.coollittlebattery.Status", &status_vtable },
+    { "org.coollittlebattery.Monitor", &monitor_vtable },
+};
+
+static void on_bus_acquired(GDBusConnection *connection, const gchar *name, gpointer data) {
+    for (size_t i = 0; i < G_N_ELEMENTS(dbus_interfaces); i++) {
+        GError *error = NULL;
+        if (!g_dbus_connection_register_object(connection, DBUS_OBJECT_PATH,
+                                               g_dbus_node_info_lookup_interface(dbus_introspection,
+                                                                                 dbus_interfaces[i].name),
+                                               dbus_interfaces[i].vtable, NULL, NULL, &error)) {
+            log_error(NULL, "❌ Failed to export %s on D-Bus: %s", dbus_interfaces[i].name, error->message);
+            g_error_free(error);
+        }
+    }
+    dbus_connection = connection;
+}
+
+static void on_bus_name_lost(GDBusConnection *connection, const gchar *name, gpointer data) {
+    // Also reached when there is no session bus at all, e.g. on headless boxes
+    log_info(NULL, "🔋 D-Bus name %s not owned, stats are not exported", name);
+    dbus_connection = NULL;
+    clear_monitor_announced();
+}
+
+// Claim the bus name; objects are registered once the connection is up
+static void setup_dbus_service(void) {
+    GError *error = NULL;
+    
+    dbus_introspection = g_dbus_node_info_new_for_xml(dbus_introspection_xml, &error);
+    if (!dbus_introspection) {
+        log_error(NULL, "❌ Bad D-Bus introspection data: %s", error->message);
+        g_error_free(error);
+        return;
+    }
+    
+    dbus_owner_id = g_bus_own_name(G_BUS_TYPE_SESSION, DBUS_SERVICE_NAME, G_BUS_NAME_OWNER_FLAGS_NONE,
+                                   on_bus_acquired, NULL, on_bus_name_lost, NULL, NULL);
+}
+
+static void teardown_dbus_service(void) {
+    dbus_connection = NULL;
+    clear_monitor_announced();
+    if (dbus_owner_id) {
+        g_bus_unown_name(dbus_owner_id);
+        dbus_owner_id = 0;
+    }
+    if (dbus_introspection) {
+        g_dbus_node_info_unref(dbus_introspection);
+        dbus_introspection = NULL;
+    }
+}
+
+// --stats: ask the running monitor for its counters and print one "name value" per line
+static int run_stats_client(void) {
+    GError *error = NULL;
+    GDBusConnection *bus = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, &error);
+    if (!bus) {
+        fprintf(stderr, "No session bus: %s\n", error->message);
+        g_error_free(error);
+        return 1;
+    }
+    
+    GVariant *reply = g_dbus_connection_call_sync(bus, DBUS_SERVICE_NAME, DBUS_OBJECT_PATH,
+                                                  "org.coollittlebattery.Stats", "GetStats", NULL,
+                                                  G_VARIANT_TYPE("(a{st})"), G_DBUS_CALL_FLAGS_NONE,
+                                                  1000, NULL, &error);
+    g_object_unref(bus);
+    if (!reply) {
+        fprintf(stderr, "Battery monitor not reachable: %s\n", error->message);
+        g_error_free(error);
+        return 1;
+    }
+    
+    GVariantIter *iter;
+    const gchar *name;
+    guint64 value;
+    g_variant_get(reply, "(a{st})", &iter);
+    while (g_variant_iter_next(iter, "{&st}", &name, &value)) {
+        printf("%s %" G_GUINT64_FORMAT "\n", name, value);
+    }
+    g_variant_iter_free(iter);
+    g_variant_unref(reply);
+    return 0;
+}
+
+// Setup that can wait until the icon is up and the main loop is idle
+static gboolean finish_startup(gpointer data) {
+    // Connect to logind ahead of time for fast suspend
+    setup_logind_proxy();
+    
+    // Pick up edits to the config file without a restart
+    setup_config_watch();
+    
+    // Let local tools and fleet agents read the counters
+    setup_dbus_service();
+    return G_SOURCE_REMOVE;
 }
 
 // Main function
 int main(int argc, char *argv[]) {
-    printf("🔋 Cool Little Battery Monitor Starting...\n");
-    printf("   Made with love for Pop!_OS users who want REAL battery protection! 💕\n");
+    startup_begin_time = g_get_monotonic_time();
+    telemetry_last_attempt = startup_begin_time;
+    
+    HarnessOptions harness = { 1000, -1, -1, NULL };
+    const char *replay_path = NULL;
+    int bench_samples = 0;
+    int stats_dump = 0;
+    int status_dump = 0;
+    
+    // Command line tools that don't need the tray
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--bench-sysfs") == 0) {
+            bench_samples = (i + 1 < argc) ? atoi(argv[i + 1]) : 0;
+            if (bench_samples <= 0) bench_samples = 10000;
+        } else if (strcmp(argv[i], "--sysfs-root") == 0 && i + 1 < argc) {
+            snprintf(sysfs_root, sizeof(sysfs_root), "%s", argv[++i]);
+            sysfs_root_override = 1;
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replay_path = argv[++i];
+        } else if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc) {
+            harness.speed = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--mode") == 0 && i + 1 < argc) {
+            harness.mode = argv[++i];
+        } else if (strcmp(argv[i], "--expect-warning") == 0 && i + 1 < argc) {
+            harness.expect_warning = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--expect-suspend") == 0 && i + 1 < argc) {
+            harness.expect_suspend = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            stats_dump = 1;
+        } else if (strcmp(argv[i], "--status") == 0) {
+            status_dump = 1;
+        } else if (strcmp(argv[i], "--headless") == 0) {
+            headless_mode = 1;
+        } else if (strcmp(argv[i], "--startup-time") == 0) {
+            startup_timing = 1;
+        }
+    }
+    
+    // Plain "name value" lines for scrapers, so no banner
+    if (stats_dump) {
+        return run_stats_client();
+    }
+    if (status_dump) {
+        return run_status_client();
+    }
+    
+    log_info(NULL, "🔋 Cool Little Battery Monitor Starting...");
+    log_info(NULL, "   Made with love for Pop!_OS users who want REAL battery protection! 💕");
+    
+    if (bench_samples > 0) {
+        return run_sysfs_benchmark(bench_samples);
+    }
+    if (replay_path) {
+        // Default thresholds, so expected sample indices don't depend on the user's config
+        init_default_config();
+        return run_replay_harness(replay_path, &harness);
+    }
     
-    // Initialize GTK
-    gtk_init(&argc, &argv);
+    // Initialize GTK, unless there's no desktop to show anything on
+    if (!headless_mode) {
+        gtk_init(&argc, &argv);
+    }
     
     // Initialize default config
     init_default_config();
     
     // Load configuration
     load_config();
+    open_logger();
     
     // Check if battery exists
     BatteryStatus initial_status = get_battery_status();
     if (!initial_status.present) {
-        printf("❌ No battery detected! This monitor is for laptops with batteries.\n");
-        printf("   If you're on a desktop, you don't need this awesome protection! 🖥️\n");
-        return 1;
-    }
-    
-    // Initialize libnotify
-    if (!notify_init("Cool Little Battery Monitor")) {
-        printf("❌ Failed to initialize libnotify\n");
+        log_error(NULL, "❌ No battery detected! This monitor is for laptops with batteries.");
+        log_info(NULL, "   If you're on a desktop, you don't need this awesome protection! 🖥️");
         return 1;
     }
     
-    // Create system tray icon
-    tray_icon = gtk_status_icon_new_from_icon_name(config.icon_battery);
-    
-    if (!tray_icon) {
-        printf("❌ Failed to create system tray icon\n");
-        return 1;
+    // Only the tray icon and the first battery read are on the startup path:
+    // the notification proxy starts with the first alert and the menu with the first right-click
+    if (!headless_mode) {
+        // Create system tray icon
+        tray_icon = gtk_status_icon_new_from_icon_name(config.icon_battery);
+        
+        if (!tray_icon) {
+            log_error(NULL, "❌ Failed to create system tray icon");
+            return 1;
+        }
+        
+        gtk_status_icon_set_visible(tray_icon, TRUE);
+        gtk_status_icon_set_title(tray_icon, "🔋 Cool Little Battery Monitor");
+        if (startup_timing) {
+            g_signal_connect(G_OBJECT(tray_icon), "notify::embedded", G_CALLBACK(on_tray_embedded), NULL);
+        }
+        
+        // Connect signals
+        g_signal_connect(G_OBJECT(tray_icon), "activate", G_CALLBACK(on_status_clicked), NULL);
+        g_signal_connect(G_OBJECT(tray_icon), "popup-menu", G_CALLBACK(on_tray_popup), NULL);
+        g_signal_connect(G_OBJECT(tray_icon), "size-changed", G_CALLBACK(on_tray_size_changed), NULL);
+        g_signal_connect(gtk_icon_theme_get_default(), "changed", G_CALLBACK(on_icon_theme_changed), NULL);
     }
     
-    gtk_status_icon_set_visible(tray_icon, TRUE);
-    gtk_status_icon_set_title(tray_icon, "🔋 Cool Little Battery Monitor");
+    // Setup signal handlers
+    setup_signal_handlers();
     
-    // Create menu
-    create_menu();
+    g_idle_add_full(G_PRIORITY_LOW, finish_startup, NULL, NULL);
     
-    // Connect signals
-    g_signal_connect(G_OBJECT(tray_icon), "activate", G_CALLBACK(on_status_clicked), NULL);
-    g_signal_connect(G_OBJECT(tray_icon), "popup-menu", G_CALLBACK(on_tray_popup), NULL);
+    // Record every sample for later investigation
+    open_history();
+    open_discharge_model();
     
-    // Setup signal handlers
-    setup_signal_handlers();
+    // Let status bars and scripts read our state instead of polling sysfs
+    open_status_segment();
     
-    // Start battery monitoring timer
-    timer_id = g_timeout_add(config.check_interval * 1000, check_battery_timer, NULL);
+    // Subscribe to battery events, keeping a timer as the safety net
+    if (config.event_driven) {
+        setup_uevent_monitor();
+    }
     
-    // Initial check
+    // Initial check, which also arms the battery monitoring timer
     check_battery_timer(NULL);
     
-    printf("🔋 System tray battery monitor active! Right-click the tray icon for options.\n");
-    printf("   Your battery is now under cool little protection! 🛡️\n");
+    if (headless_mode) {
+        log_info(NULL, "🔋 Headless battery monitor active, alerts go to the journal.");
+        report_startup_metrics();
+    } else {
+        log_info(NULL, "🔋 System tray battery monitor active! Right-click the tray icon for options.");
+    }
+    log_info(NULL, "   Your battery is now under cool little protection! 🛡️");
     
-    // Start GTK main loop
-    gtk_main();
+    // Start main loop; GTK dispatches through the default context either way
+    main_loop = g_main_loop_new(NULL, FALSE);
+    g_main_loop_run(main_loop);
+    g_main_loop_unref(main_loop);
+    main_loop = NULL;
     
     // Cleanup
     if (timer_id) {
         g_source_remove(timer_id);
     }
+    teardown_uevent_monitor();
+    teardown_config_watch();
+    teardown_dbus_service();
+    close_battery_handles();
+    release_graph_surface();
+    close_history();
+    close_status_segment();
+    release_sleep_inhibitor();
+    if (logind_proxy) {
+        g_object_unref(logind_proxy);
+    }
     
-    notify_uninit();
-    save_config();
+    clear_tray_icon_cache();
+    if (notify_proxy) {
+        g_object_unref(notify_proxy);
+    }
+    
+    // Only touch the file if something is still unsaved
+    if (config_dirty) {
+        save_config();
+    }
     
-    printf("🔋 Cool Little Battery Monitor stopped. Stay safe! 💕\n");
+    log_info(NULL, "🔋 Cool Little Battery Monitor stopped. Stay safe! 💕");
+    close_logger();
     return 0;
 } 